@@ -0,0 +1,39 @@
+/*--------------------------------------------------------------------------/
+  /                                                                           /
+  / bench.h                                                                   /
+  / Timing and random helpers shared by the benchmarks                        /
+  /                                                                           /
+  /--------------------------------------------------------------------------*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Seconds on a monotonic clock. Benchmark sources define _POSIX_C_SOURCE
+// before their includes so clock_gettime is declared.
+static inline double bench_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+// xorshift32, so every run and platform sees the same inputs. state must not
+// start at 0.
+static inline uint32_t bench_random(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+// uniform in [min, max)
+static inline float bench_random_float(uint32_t *state, const float min,
+                                       const float max) {
+  return min + (max - min) * (float)(bench_random(state) >> 8) *
+                   (1.0f / 16777216.0f);
+}
+
+#endif // BENCH_H
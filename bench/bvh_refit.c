@@ -0,0 +1,89 @@
+// Builds a bvh over 1M random boxes, then moves every box each frame and times
+// bvh_refit against rebuilding with bvh_build, printing bvh_cost of both trees
+// so the refit tree's degradation can be read off next to its time.
+//
+//   make bench && ./build/bench/bvh_refit [frames]
+#define _POSIX_C_SOURCE 200809L
+
+#include "bench.h"
+#include "bvh.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_BVH_COUNT (1000000)
+// boxes start in a cube this wide and move up to BENCH_BVH_SPEED per frame
+#define BENCH_BVH_EXTENT (1000.0f)
+#define BENCH_BVH_SPEED (2.0f)
+
+int main(int argc, char **argv) {
+  const int frames = argc > 1 ? atoi(argv[1]) : 10;
+
+  bvh_aabb *boxes = malloc(sizeof(bvh_aabb) * BENCH_BVH_COUNT);
+  vector3 *velocities = malloc(sizeof(vector3) * BENCH_BVH_COUNT);
+  if (boxes == NULL || velocities == NULL) {
+    printf("out of memory\n");
+    return 1;
+  }
+
+  uint32_t state = 0x42564821u;
+  for (unsigned int i = 0; i < BENCH_BVH_COUNT; i++) {
+    const vector3 center = {
+        bench_random_float(&state, 0, BENCH_BVH_EXTENT),
+        bench_random_float(&state, 0, BENCH_BVH_EXTENT),
+        bench_random_float(&state, 0, BENCH_BVH_EXTENT)};
+    const float half = bench_random_float(&state, 0.25f, 1);
+    boxes[i] = (bvh_aabb){
+        .min = {center.x - half, center.y - half, center.z - half},
+        .max = {center.x + half, center.y + half, center.z + half},
+    };
+    velocities[i] = (vector3){
+        bench_random_float(&state, -BENCH_BVH_SPEED, BENCH_BVH_SPEED),
+        bench_random_float(&state, -BENCH_BVH_SPEED, BENCH_BVH_SPEED),
+        bench_random_float(&state, -BENCH_BVH_SPEED, BENCH_BVH_SPEED)};
+  }
+
+  bvh refitted = bvh_alloc();
+  bvh rebuilt = bvh_alloc();
+
+  double start = bench_now();
+  bvh_build(&refitted, boxes, BENCH_BVH_COUNT);
+  const double build_time = bench_now() - start;
+  const float built_cost = bvh_cost(&refitted);
+  printf("%d boxes, build %.1f ms, cost %.1f\n", BENCH_BVH_COUNT,
+         build_time * 1e3, built_cost);
+  printf("frame   refit ms  refit cost   build ms  build cost\n");
+
+  double refit_total = 0;
+  double build_total = 0;
+  for (int frame = 1; frame <= frames; frame++) {
+    for (unsigned int i = 0; i < BENCH_BVH_COUNT; i++) {
+      boxes[i].min = vector3_add(boxes[i].min, velocities[i]);
+      boxes[i].max = vector3_add(boxes[i].max, velocities[i]);
+    }
+
+    start = bench_now();
+    bvh_refit(&refitted, boxes);
+    const double refit_time = bench_now() - start;
+
+    start = bench_now();
+    bvh_build(&rebuilt, boxes, BENCH_BVH_COUNT);
+    const double rebuild_time = bench_now() - start;
+
+    refit_total += refit_time;
+    build_total += rebuild_time;
+    printf("%5d %10.1f %11.1f %10.1f %11.1f\n", frame, refit_time * 1e3,
+           bvh_cost(&refitted), rebuild_time * 1e3, bvh_cost(&rebuilt));
+  }
+
+  if (frames > 0) {
+    printf("mean  %10.1f %22.1f\n", refit_total / frames * 1e3,
+           build_total / frames * 1e3);
+  }
+
+  bvh_free(&refitted);
+  bvh_free(&rebuilt);
+  free(boxes);
+  free(velocities);
+  return 0;
+}
@@ -0,0 +1,163 @@
+// Times mat4_from_trs and mat4_from_rt_inverse against the scale, rotate and
+// translate mat4_multiply chains they replaced, and checks that both give the
+// same matrices. Exits with 1 if they differ.
+//
+//   make bench && ./build/bench/mat4
+#define _POSIX_C_SOURCE 200809L
+
+#include "bench.h"
+#include "math3d.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#define BENCH_MAT4_COUNT (4096)
+#define BENCH_MAT4_PASSES (200)
+
+typedef struct {
+  vector3 position;
+  vector3 scale;
+  vector4 rotation;
+} bench_mat4_transform;
+
+// the model matrix as renderer_gl_transform_matrix built it before
+// mat4_from_trs
+static void bench_mat4_trs_multiply(float *matrix,
+                                    const bench_mat4_transform *transform) {
+  mat4_identity(matrix);
+
+  float scale[16];
+  mat4_identity(scale);
+  scale[0] = transform->scale.x;
+  scale[5] = transform->scale.y;
+  scale[10] = transform->scale.z;
+
+  float translation[16];
+  mat4_identity(translation);
+  translation[12] = transform->position.x;
+  translation[13] = transform->position.y;
+  translation[14] = transform->position.z;
+
+  float rotation[16] = {0};
+  quaternion_to_mat4(transform->rotation, rotation);
+
+  mat4_multiply(matrix, scale, rotation);
+  mat4_multiply(matrix, matrix, translation);
+}
+
+// the view matrix as renderer_gl_camera_update built it before
+// mat4_from_rt_inverse
+static void bench_mat4_view_multiply(float *matrix,
+                                     const bench_mat4_transform *transform) {
+  float translation[16];
+  mat4_identity(translation);
+  translation[12] = -transform->position.x;
+  translation[13] = -transform->position.y;
+  translation[14] = -transform->position.z;
+
+  float rotation[16];
+  mat4_identity(rotation);
+  quaternion_to_mat4(quaternion_conjugate(transform->rotation), rotation);
+
+  mat4_multiply(matrix, translation, rotation);
+}
+
+static void bench_mat4_trs(float *matrix,
+                           const bench_mat4_transform *transform) {
+  mat4_from_trs(matrix, transform->position, transform->rotation,
+                transform->scale);
+}
+
+static void bench_mat4_view(float *matrix,
+                            const bench_mat4_transform *transform) {
+  mat4_from_rt_inverse(matrix, transform->position, transform->rotation);
+}
+
+typedef void (*bench_mat4_function)(float *matrix,
+                                    const bench_mat4_transform *transform);
+
+// best time of BENCH_MAT4_PASSES over every transform, in ns per matrix
+static double bench_mat4_time(bench_mat4_function function,
+                              const bench_mat4_transform *transforms,
+                              float *matrices) {
+  double best = 1e30;
+  for (int pass = 0; pass < BENCH_MAT4_PASSES; pass++) {
+    const double start = bench_now();
+    for (int i = 0; i < BENCH_MAT4_COUNT; i++) {
+      function(matrices + i * 16, &transforms[i]);
+    }
+    const double elapsed = bench_now() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  return best / BENCH_MAT4_COUNT * 1e9;
+}
+
+// largest difference between the matrices of the two functions, relative to
+// the largest element
+static float bench_mat4_compare(bench_mat4_function a, bench_mat4_function b,
+                                const bench_mat4_transform *transforms) {
+  float worst = 0;
+  for (int i = 0; i < BENCH_MAT4_COUNT; i++) {
+    float ma[16];
+    float mb[16];
+    a(ma, &transforms[i]);
+    b(mb, &transforms[i]);
+
+    float largest = 1;
+    for (int k = 0; k < 16; k++) {
+      largest = fabsf(ma[k]) > largest ? fabsf(ma[k]) : largest;
+    }
+    for (int k = 0; k < 16; k++) {
+      const float difference = fabsf(ma[k] - mb[k]) / largest;
+      worst = difference > worst ? difference : worst;
+    }
+  }
+  return worst;
+}
+
+int main(void) {
+  static bench_mat4_transform transforms[BENCH_MAT4_COUNT];
+  static float matrices[BENCH_MAT4_COUNT * 16];
+
+  uint32_t state = 0x4D415434u;
+  for (int i = 0; i < BENCH_MAT4_COUNT; i++) {
+    vector4 q = {
+        bench_random_float(&state, -1, 1), bench_random_float(&state, -1, 1),
+        bench_random_float(&state, -1, 1), bench_random_float(&state, -1, 1)};
+    const float length = sqrtf(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+    q = (vector4){q.x / length, q.y / length, q.z / length, q.w / length};
+
+    transforms[i] = (bench_mat4_transform){
+        .position = {bench_random_float(&state, -100, 100),
+                     bench_random_float(&state, -100, 100),
+                     bench_random_float(&state, -100, 100)},
+        .scale = {bench_random_float(&state, 0.1f, 4),
+                  bench_random_float(&state, 0.1f, 4),
+                  bench_random_float(&state, 0.1f, 4)},
+        .rotation = q,
+    };
+  }
+
+  const float trs_error = bench_mat4_compare(bench_mat4_trs_multiply,
+                                             bench_mat4_trs, transforms);
+  const float view_error = bench_mat4_compare(bench_mat4_view_multiply,
+                                              bench_mat4_view, transforms);
+
+  printf("%d transforms, best of %d passes\n", BENCH_MAT4_COUNT,
+         BENCH_MAT4_PASSES);
+  printf("model  mat4_multiply x2 %7.2f ns  mat4_from_trs        %7.2f ns  "
+         "difference %g\n",
+         bench_mat4_time(bench_mat4_trs_multiply, transforms, matrices),
+         bench_mat4_time(bench_mat4_trs, transforms, matrices), trs_error);
+  printf("view   mat4_multiply    %7.2f ns  mat4_from_rt_inverse %7.2f ns  "
+         "difference %g\n",
+         bench_mat4_time(bench_mat4_view_multiply, transforms, matrices),
+         bench_mat4_time(bench_mat4_view, transforms, matrices), view_error);
+
+  // the closed forms round differently than the chains in the last bits
+  const int same = trs_error <= 1e-5f && view_error <= 1e-5f;
+  if (!same) {
+    printf("closed forms differ from the mat4_multiply chains\n");
+  }
+  return same ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+// Times obj_parse on a generated grid of about 1M triangles with positions,
+// texcoords and normals for 1 to threads threads, and checks its float parsing
+// against strtof. One thread is the single pass parser without a job system,
+// n threads are jobs_start(n - 1) workers plus the calling thread. Exits with
+// 1 if the thread counts give different triangle counts or a parsed value is
+// more than 1 ulp from strtof.
+//
+//   make bench && ./build/bench/obj_parse [runs] [threads]
+#define _POSIX_C_SOURCE 200809L
+
+#include "bench.h"
+#include "jobs.h"
+#include "obj.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// quads per grid side, two triangles each
+#define BENCH_OBJ_SIDE (708)
+#define BENCH_OBJ_FLOATS (1000000)
+
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+} bench_obj_text;
+
+static void bench_obj_printf(bench_obj_text *text, const char *format, ...) {
+  if (text->capacity - text->length < 256) {
+    text->capacity = text->capacity ? text->capacity * 2 : 1 << 20;
+    text->data = realloc(text->data, text->capacity);
+    if (text->data == NULL) {
+      printf("out of memory\n");
+      exit(1);
+    }
+  }
+  va_list arguments;
+  va_start(arguments, format);
+  text->length += (size_t)vsnprintf(text->data + text->length,
+                                    text->capacity - text->length, format,
+                                    arguments);
+  va_end(arguments);
+}
+
+// (side + 1)^2 vertices on a bumpy plane, one shared normal and a quad face
+// per cell, the quads split into triangles by obj_parse. Coordinates get 17
+// digits, close to the 104 MB grid the parser was first measured on, so MB/s
+// stays comparable.
+static bench_obj_text bench_obj_grid(void) {
+  bench_obj_text text = {0};
+  const int points = BENCH_OBJ_SIDE + 1;
+  uint32_t state = 0x4F424A21u;
+
+  for (int y = 0; y < points; y++) {
+    for (int x = 0; x < points; x++) {
+      bench_obj_printf(&text, "v %.17g %.17g %.17g\n",
+                       (double)x / BENCH_OBJ_SIDE, (double)y / BENCH_OBJ_SIDE,
+                       (double)bench_random_float(&state, 0, 1));
+    }
+  }
+  for (int y = 0; y < points; y++) {
+    for (int x = 0; x < points; x++) {
+      bench_obj_printf(&text, "vt %.17g %.17g\n", (double)x / BENCH_OBJ_SIDE,
+                       (double)y / BENCH_OBJ_SIDE);
+    }
+  }
+  bench_obj_printf(&text, "vn 0 0 1\n");
+  for (int y = 0; y < BENCH_OBJ_SIDE; y++) {
+    for (int x = 0; x < BENCH_OBJ_SIDE; x++) {
+      const int a = y * points + x + 1;
+      const int b = a + 1;
+      const int c = a + points;
+      const int d = c + 1;
+      bench_obj_printf(&text, "f %d/%d/1 %d/%d/1 %d/%d/1 %d/%d/1\n", a, a, b,
+                       b, d, d, c, c);
+    }
+  }
+  return text;
+}
+
+// best of runs, in seconds
+static double bench_obj_time(const bench_obj_text *text, const int runs,
+                             size_t *triangles) {
+  double best = 1e30;
+  for (int run = 0; run < runs; run++) {
+    const double start = bench_now();
+    obj_mesh mesh = obj_parse(text->data, text->length);
+    const double elapsed = bench_now() - start;
+    best = elapsed < best ? elapsed : best;
+    *triangles = sc_list_obj_corner_count(mesh.corners) / 3;
+    obj_free(&mesh);
+  }
+  return best;
+}
+
+static uint32_t bench_obj_bits(const float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+// Writes random floats in the notations OBJ exporters use, parses them as
+// positions and returns the largest distance from strtof in ulps.
+static uint32_t bench_obj_check_floats(void) {
+  static const char *formats[] = {"%f", "%.9g", "%e", "%.3f", "%.17g"};
+  bench_obj_text text = {0};
+  uint32_t state = 0x464C5421u;
+
+  for (int i = 0; i < BENCH_OBJ_FLOATS / 3; i++) {
+    bench_obj_printf(&text, "v");
+    for (int k = 0; k < 3; k++) {
+      const float magnitude = bench_random_float(&state, -8, 8);
+      double value = bench_random_float(&state, -1, 1);
+      for (int e = 0; e < (int)(magnitude < 0 ? -magnitude : magnitude); e++) {
+        value = magnitude < 0 ? value / 10 : value * 10;
+      }
+      bench_obj_printf(&text, " ");
+      bench_obj_printf(&text, formats[bench_random(&state) % 5], value);
+    }
+    bench_obj_printf(&text, "\n");
+  }
+
+  obj_mesh mesh = obj_parse(text.data, text.length);
+
+  uint32_t worst = 0;
+  const char *c = text.data;
+  for (size_t i = 0; i < sc_list_vector3_count(mesh.positions); i++) {
+    const float parsed[3] = {mesh.positions[i].x, mesh.positions[i].y,
+                             mesh.positions[i].z};
+    char *next = (char *)c + 1;
+    for (int k = 0; k < 3; k++) {
+      const float expected = strtof(next, &next);
+      const uint32_t a = bench_obj_bits(expected);
+      const uint32_t b = bench_obj_bits(parsed[k]);
+      // same sign for every value that is not zero, so the bit patterns are
+      // ordered
+      const uint32_t distance = a > b ? a - b : b - a;
+      worst = distance > worst ? distance : worst;
+    }
+    c = strchr(next, '\n') + 1;
+  }
+
+  obj_free(&mesh);
+  free(text.data);
+  return worst;
+}
+
+int main(int argc, char **argv) {
+  const int runs = argc > 1 ? atoi(argv[1]) : 5;
+  const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  const int threads = argc > 2 ? atoi(argv[2]) : 8;
+
+  bench_obj_text text = bench_obj_grid();
+  size_t expected = 0;
+  int same = 1;
+  printf("%.1f MB, best of %d, %ld cores\n", text.length / 1e6, runs, cores);
+  for (int thread = 1; thread <= threads; thread++) {
+    if (thread > 1) {
+      jobs_start((unsigned int)thread - 1);
+    }
+    size_t triangles = 0;
+    const double best = bench_obj_time(&text, runs, &triangles);
+    jobs_free();
+    printf("%2d threads %8.1f ms %8.1f MB/s %zu triangles\n", thread,
+           best * 1e3, text.length / 1e6 / best, triangles);
+
+    expected = thread == 1 ? triangles : expected;
+    same = same && triangles == expected;
+  }
+  free(text.data);
+
+  const uint32_t worst = bench_obj_check_floats();
+  printf("%d floats, largest difference from strtof %u ulp\n",
+         BENCH_OBJ_FLOATS / 3 * 3, worst);
+  if (!same) {
+    printf("chunked parses differ from the single pass\n");
+  }
+  return same && worst <= 1 ? 0 : 1;
+}
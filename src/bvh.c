@@ -0,0 +1,578 @@
+#include "bvh.h"
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+// leaves are made once a node holds this many items or less
+#define BVH__LEAF_SIZE (4)
+// nodes up to this size become leaves when splitting does not pay off
+#define BVH__MAX_LEAF_SIZE (16)
+#define BVH__BINS (12)
+// traversal stacks on the call stack up to this depth, on the heap beyond
+#define BVH__STACK_SIZE (64)
+// marks stack entries whose subtree is fully inside the frustum
+#define BVH__INSIDE (0x80000000u)
+
+static bvh_aabb bvh__empty(void) {
+  return (bvh_aabb){
+      .min = {FLT_MAX, FLT_MAX, FLT_MAX},
+      .max = {-FLT_MAX, -FLT_MAX, -FLT_MAX},
+  };
+}
+
+static bvh_aabb bvh__union(const bvh_aabb a, const bvh_aabb b) {
+  return (bvh_aabb){
+      .min = vector3_min(a.min, b.min),
+      .max = vector3_max(a.max, b.max),
+  };
+}
+
+static bvh_aabb bvh__grow(const bvh_aabb a, const vector3 point) {
+  return (bvh_aabb){
+      .min = vector3_min(a.min, point),
+      .max = vector3_max(a.max, point),
+  };
+}
+
+static float bvh__area(const bvh_aabb b) {
+  const vector3 d = vector3_sub(b.max, b.min);
+  if (d.x < 0 || d.y < 0 || d.z < 0) {
+    return 0;
+  }
+  return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static vector3 bvh__centroid(const bvh_aabb b) {
+  return vector3_scaled(vector3_add(b.min, b.max), 0.5f);
+}
+
+static float bvh__axis(const vector3 v, const int axis) {
+  return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+// squared distance from point to the box, 0 inside
+static float bvh__distance_squared(const bvh_aabb *b, const vector3 point) {
+  const vector3 d = vector3_max(vector3_sub(b->min, point),
+                                vector3_sub(point, b->max));
+  const vector3 outside = vector3_max(d, (vector3){0, 0, 0});
+  return vector3_square_magnitude(outside);
+}
+
+// entry distance of the ray into the box, or -1 when it misses or enters
+// beyond limit. inverse is 1 / direction per axis.
+static float bvh__ray_box(const bvh_aabb *b, const vector3 origin,
+                          const vector3 inverse, const float limit) {
+  const float x1 = (b->min.x - origin.x) * inverse.x;
+  const float x2 = (b->max.x - origin.x) * inverse.x;
+  const float y1 = (b->min.y - origin.y) * inverse.y;
+  const float y2 = (b->max.y - origin.y) * inverse.y;
+  const float z1 = (b->min.z - origin.z) * inverse.z;
+  const float z2 = (b->max.z - origin.z) * inverse.z;
+
+  const float enter =
+      fmaxf(fmaxf(fminf(x1, x2), fminf(y1, y2)), fmaxf(fminf(z1, z2), 0));
+  const float exit = fminf(fminf(fmaxf(x1, x2), fmaxf(y1, y2)), fmaxf(z1, z2));
+
+  if (exit < enter || enter > limit) {
+    return -1;
+  }
+  return enter;
+}
+
+// 0 when the box is outside one of the planes, 2 when it is inside all of
+// them, 1 otherwise.
+static int bvh__frustum_test(const bvh_aabb *b, const vector4 *planes) {
+  int inside = 1;
+
+  for (int i = 0; i < 6; i++) {
+    const vector4 p = planes[i];
+    const vector3 far = {
+        p.x >= 0 ? b->max.x : b->min.x,
+        p.y >= 0 ? b->max.y : b->min.y,
+        p.z >= 0 ? b->max.z : b->min.z,
+    };
+    if (p.x * far.x + p.y * far.y + p.z * far.z + p.w < 0) {
+      return 0;
+    }
+
+    const vector3 near = {
+        p.x >= 0 ? b->min.x : b->max.x,
+        p.y >= 0 ? b->min.y : b->max.y,
+        p.z >= 0 ? b->min.z : b->max.z,
+    };
+    if (p.x * near.x + p.y * near.y + p.z * near.z + p.w < 0) {
+      inside = 0;
+    }
+  }
+
+  return inside ? 2 : 1;
+}
+
+static unsigned int *bvh__stack_alloc(const bvh *tree, unsigned int *local) {
+  if (tree->depth < BVH__STACK_SIZE) {
+    return local;
+  }
+  return malloc(sizeof(unsigned int) * (tree->depth + 1));
+}
+
+static void bvh__stack_free(unsigned int *stack, unsigned int *local) {
+  if (stack != local) {
+    free(stack);
+  }
+}
+
+static unsigned int bvh__node_alloc(bvh *tree, const unsigned int count) {
+  if (tree->node_count + count > tree->node_capacity) {
+    tree->node_capacity = tree->node_capacity * 2 + count;
+    tree->nodes =
+        realloc(tree->nodes, sizeof(*tree->nodes) * tree->node_capacity);
+  }
+
+  const unsigned int first = tree->node_count;
+  tree->node_count += count;
+  return first;
+}
+
+static bvh_aabb bvh__leaf_bounds(const bvh *tree, const bvh_node *leaf) {
+  bvh_aabb bounds = bvh__empty();
+  for (unsigned int i = leaf->first; i < leaf->first + leaf->count; i++) {
+    bounds = bvh__union(bounds, tree->item_bounds[tree->items[i]]);
+  }
+  return bounds;
+}
+
+// an item while building, kept next to its bounds so partitioning the range
+// of a node touches memory in order.
+typedef struct {
+  bvh_aabb bounds;
+  vector3 center;
+  unsigned int item;
+} bvh__build_item;
+
+static void bvh__make_leaf(bvh *tree, const bvh__build_item *work,
+                           const unsigned int index) {
+  const bvh_node *leaf = &tree->nodes[index];
+  for (unsigned int i = leaf->first; i < leaf->first + leaf->count; i++) {
+    tree->items[i] = work[i].item;
+    tree->item_leaves[work[i].item] = index;
+  }
+
+  unsigned int depth = 0;
+  for (unsigned int n = index; tree->nodes[n].parent != BVH_NONE;
+       n = tree->nodes[n].parent) {
+    depth++;
+  }
+  tree->depth = depth > tree->depth ? depth : tree->depth;
+}
+
+static unsigned int bvh__bin(const float centroid, const float min,
+                             const float scale) {
+  const int bin = (int)((centroid - min) * scale);
+  return bin < 0 ? 0 : bin >= BVH__BINS ? BVH__BINS - 1 : (unsigned int)bin;
+}
+
+// Splits the node where the binned surface area heuristic is lowest, or makes
+// it a leaf. Returns the index of the first of the two children, or BVH_NONE.
+static unsigned int bvh__split(bvh *tree, bvh__build_item *work,
+                               const unsigned int index) {
+  const unsigned int first = tree->nodes[index].first;
+  const unsigned int count = tree->nodes[index].count;
+
+  bvh_aabb bounds = bvh__empty();
+  bvh_aabb centroids = bvh__empty();
+  for (unsigned int i = first; i < first + count; i++) {
+    bounds = bvh__union(bounds, work[i].bounds);
+    centroids = bvh__grow(centroids, work[i].center);
+  }
+  tree->nodes[index].bounds = bounds;
+
+  if (count <= BVH__LEAF_SIZE) {
+    bvh__make_leaf(tree, work, index);
+    return BVH_NONE;
+  }
+
+  float best_cost = FLT_MAX;
+  int best_axis = -1;
+  unsigned int best_bin = 0;
+
+  // bin every axis in one pass over the items
+  float axis_min[3], axis_scale[3];
+  bvh_aabb bin_bounds[3][BVH__BINS];
+  unsigned int bin_counts[3][BVH__BINS] = {{0}};
+  for (int axis = 0; axis < 3; axis++) {
+    axis_min[axis] = bvh__axis(centroids.min, axis);
+    const float extent = bvh__axis(centroids.max, axis) - axis_min[axis];
+    axis_scale[axis] = extent > 0 ? BVH__BINS / extent : 0;
+    for (int b = 0; b < BVH__BINS; b++) {
+      bin_bounds[axis][b] = bvh__empty();
+    }
+  }
+
+  for (unsigned int i = first; i < first + count; i++) {
+    const bvh_aabb b = work[i].bounds;
+    for (int axis = 0; axis < 3; axis++) {
+      const unsigned int bin = bvh__bin(bvh__axis(work[i].center, axis),
+                                        axis_min[axis], axis_scale[axis]);
+      bin_counts[axis][bin]++;
+      bin_bounds[axis][bin] = bvh__union(bin_bounds[axis][bin], b);
+    }
+  }
+
+  for (int axis = 0; axis < 3; axis++) {
+    if (axis_scale[axis] == 0) {
+      continue;
+    }
+
+    // sweep from the left storing area * count, then from the right
+    float left_cost[BVH__BINS - 1];
+    unsigned int left_counts[BVH__BINS - 1];
+    bvh_aabb left = bvh__empty();
+    unsigned int left_count = 0;
+    for (int b = 0; b < BVH__BINS - 1; b++) {
+      left = bvh__union(left, bin_bounds[axis][b]);
+      left_count += bin_counts[axis][b];
+      left_cost[b] = bvh__area(left) * left_count;
+      left_counts[b] = left_count;
+    }
+
+    bvh_aabb right = bvh__empty();
+    unsigned int right_count = 0;
+    for (int b = BVH__BINS - 1; b > 0; b--) {
+      right = bvh__union(right, bin_bounds[axis][b]);
+      right_count += bin_counts[axis][b];
+
+      if (left_counts[b - 1] == 0 || right_count == 0) {
+        continue;
+      }
+
+      const float cost = left_cost[b - 1] + bvh__area(right) * right_count;
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_bin = b - 1;
+      }
+    }
+  }
+
+  const float area = bvh__area(bounds);
+  const int worth_splitting =
+      best_axis >= 0 && area + best_cost < area * count;
+  if (!worth_splitting && count <= BVH__MAX_LEAF_SIZE) {
+    bvh__make_leaf(tree, work, index);
+    return BVH_NONE;
+  }
+
+  // with every centroid in one spot the items are split in half, in any order
+  unsigned int middle = count / 2;
+  if (best_axis >= 0) {
+    const float min = axis_min[best_axis];
+    const float scale = axis_scale[best_axis];
+
+    unsigned int i = first;
+    unsigned int j = first + count;
+    while (i < j) {
+      const float center = bvh__axis(work[i].center, best_axis);
+      if (bvh__bin(center, min, scale) <= best_bin) {
+        i++;
+      } else {
+        j--;
+        const bvh__build_item swap = work[i];
+        work[i] = work[j];
+        work[j] = swap;
+      }
+    }
+    middle = i - first;
+  }
+
+  const unsigned int children = bvh__node_alloc(tree, 2);
+  tree->nodes[children] = (bvh_node){
+      .first = first,
+      .count = middle,
+      .parent = index,
+  };
+  tree->nodes[children + 1] = (bvh_node){
+      .first = first + middle,
+      .count = count - middle,
+      .parent = index,
+  };
+  tree->nodes[index].first = children;
+  tree->nodes[index].count = 0;
+  return children;
+}
+
+bvh bvh_alloc(void) { return (bvh){0}; }
+
+void bvh_free(bvh *tree) {
+  free(tree->nodes);
+  free(tree->items);
+  free(tree->item_bounds);
+  free(tree->item_leaves);
+  *tree = bvh_alloc();
+}
+
+void bvh_build(bvh *tree, const bvh_aabb *items, const unsigned int count) {
+  tree->items = realloc(tree->items, sizeof(*tree->items) * count);
+  tree->item_bounds =
+      realloc(tree->item_bounds, sizeof(*tree->item_bounds) * count);
+  tree->item_leaves =
+      realloc(tree->item_leaves, sizeof(*tree->item_leaves) * count);
+  tree->item_count = count;
+  tree->node_count = 0;
+  tree->depth = 0;
+
+  if (count == 0) {
+    return;
+  }
+
+  memcpy(tree->item_bounds, items, sizeof(*items) * count);
+  bvh__build_item *work = malloc(sizeof(*work) * count);
+  for (unsigned int i = 0; i < count; i++) {
+    work[i] = (bvh__build_item){
+        .bounds = items[i],
+        .center = bvh__centroid(items[i]),
+        .item = i,
+    };
+  }
+
+  const unsigned int root = bvh__node_alloc(tree, 1);
+  tree->nodes[root] = (bvh_node){
+      .first = 0,
+      .count = count,
+      .parent = BVH_NONE,
+  };
+
+  // pending nodes hold disjoint, non empty item ranges, so count bounds them
+  unsigned int *pending = malloc(sizeof(*pending) * count);
+  unsigned int pending_count = 0;
+  pending[pending_count++] = root;
+
+  while (pending_count > 0) {
+    const unsigned int children =
+        bvh__split(tree, work, pending[--pending_count]);
+    if (children != BVH_NONE) {
+      pending[pending_count++] = children;
+      pending[pending_count++] = children + 1;
+    }
+  }
+
+  free(pending);
+  free(work);
+}
+
+void bvh_refit(bvh *tree, const bvh_aabb *items) {
+  memcpy(tree->item_bounds, items, sizeof(*items) * tree->item_count);
+
+  for (unsigned int i = tree->node_count; i-- > 0;) {
+    bvh_node *node = &tree->nodes[i];
+    if (node->count > 0) {
+      node->bounds = bvh__leaf_bounds(tree, node);
+    } else {
+      node->bounds = bvh__union(tree->nodes[node->first].bounds,
+                                tree->nodes[node->first + 1].bounds);
+    }
+  }
+}
+
+void bvh_update(bvh *tree, const unsigned int item, const bvh_aabb bounds) {
+  tree->item_bounds[item] = bounds;
+
+  unsigned int index = tree->item_leaves[item];
+  bvh_aabb refit = bvh__leaf_bounds(tree, &tree->nodes[index]);
+
+  while (index != BVH_NONE) {
+    bvh_node *node = &tree->nodes[index];
+    if (memcmp(&node->bounds, &refit, sizeof(refit)) == 0) {
+      break;
+    }
+    node->bounds = refit;
+
+    index = node->parent;
+    if (index != BVH_NONE) {
+      const unsigned int children = tree->nodes[index].first;
+      refit = bvh__union(tree->nodes[children].bounds,
+                         tree->nodes[children + 1].bounds);
+    }
+  }
+}
+
+float bvh_cost(const bvh *tree) {
+  if (tree->node_count == 0) {
+    return 0;
+  }
+
+  const float root = bvh__area(tree->nodes[0].bounds);
+  if (root <= 0) {
+    return 0;
+  }
+
+  float cost = 0;
+  for (unsigned int i = 0; i < tree->node_count; i++) {
+    const bvh_node *node = &tree->nodes[i];
+    cost += bvh__area(node->bounds) * (node->count > 0 ? node->count : 1);
+  }
+  return cost / root;
+}
+
+void bvh_query_frustum(const bvh *tree, const vector4 *planes,
+                       bvh_visit_function visit, void *user) {
+  if (tree->node_count == 0) {
+    return;
+  }
+
+  unsigned int local[BVH__STACK_SIZE];
+  unsigned int *stack = bvh__stack_alloc(tree, local);
+  unsigned int stack_count = 0;
+  stack[stack_count++] = 0;
+
+  while (stack_count > 0) {
+    const unsigned int entry = stack[--stack_count];
+    const bvh_node *node = &tree->nodes[entry & ~BVH__INSIDE];
+
+    unsigned int inside = entry & BVH__INSIDE;
+    if (!inside) {
+      const int test = bvh__frustum_test(&node->bounds, planes);
+      if (test == 0) {
+        continue;
+      }
+      inside = test == 2 ? BVH__INSIDE : 0;
+    }
+
+    if (node->count > 0) {
+      for (unsigned int i = node->first; i < node->first + node->count; i++) {
+        const unsigned int item = tree->items[i];
+        if (inside ||
+            bvh__frustum_test(&tree->item_bounds[item], planes) != 0) {
+          visit(user, item);
+        }
+      }
+    } else {
+      stack[stack_count++] = node->first | inside;
+      stack[stack_count++] = (node->first + 1) | inside;
+    }
+  }
+
+  bvh__stack_free(stack, local);
+}
+
+unsigned int bvh_query_ray(const bvh *tree, const vector3 origin,
+                           const vector3 direction, bvh_ray_function hit,
+                           void *user, float *distance) {
+  unsigned int result = BVH_NONE;
+  float best = FLT_MAX;
+
+  if (tree->node_count > 0) {
+    const vector3 inverse = {1 / direction.x, 1 / direction.y,
+                             1 / direction.z};
+
+    unsigned int local[BVH__STACK_SIZE];
+    unsigned int *stack = bvh__stack_alloc(tree, local);
+    unsigned int stack_count = 0;
+    if (bvh__ray_box(&tree->nodes[0].bounds, origin, inverse, best) >= 0) {
+      stack[stack_count++] = 0;
+    }
+
+    while (stack_count > 0) {
+      const bvh_node *node = &tree->nodes[stack[--stack_count]];
+
+      if (node->count > 0) {
+        for (unsigned int i = node->first; i < node->first + node->count;
+             i++) {
+          const unsigned int item = tree->items[i];
+          float t =
+              bvh__ray_box(&tree->item_bounds[item], origin, inverse, best);
+          if (t >= 0 && hit) {
+            t = hit(user, item, origin, direction);
+          }
+          if (t >= 0 && t < best) {
+            best = t;
+            result = item;
+          }
+        }
+        continue;
+      }
+
+      // visit the nearer child first so the farther one can be pruned
+      unsigned int near = node->first, far = node->first + 1;
+      float near_t =
+          bvh__ray_box(&tree->nodes[near].bounds, origin, inverse, best);
+      float far_t =
+          bvh__ray_box(&tree->nodes[far].bounds, origin, inverse, best);
+      if (far_t >= 0 && (near_t < 0 || far_t < near_t)) {
+        const unsigned int swap = near;
+        near = far;
+        far = swap;
+        const float swap_t = near_t;
+        near_t = far_t;
+        far_t = swap_t;
+      }
+
+      if (far_t >= 0) {
+        stack[stack_count++] = far;
+      }
+      if (near_t >= 0) {
+        stack[stack_count++] = near;
+      }
+    }
+
+    bvh__stack_free(stack, local);
+  }
+
+  if (distance) {
+    *distance = best;
+  }
+  return result;
+}
+
+unsigned int bvh_query_nearest(const bvh *tree, const vector3 point,
+                               bvh_distance_function distance_squared,
+                               void *user, float *distance) {
+  unsigned int result = BVH_NONE;
+  float best = FLT_MAX;
+
+  if (tree->node_count > 0) {
+    unsigned int local[BVH__STACK_SIZE];
+    unsigned int *stack = bvh__stack_alloc(tree, local);
+    unsigned int stack_count = 0;
+    stack[stack_count++] = 0;
+
+    while (stack_count > 0) {
+      const bvh_node *node = &tree->nodes[stack[--stack_count]];
+      if (bvh__distance_squared(&node->bounds, point) >= best) {
+        continue;
+      }
+
+      if (node->count > 0) {
+        for (unsigned int i = node->first; i < node->first + node->count;
+             i++) {
+          const unsigned int item = tree->items[i];
+          float d = bvh__distance_squared(&tree->item_bounds[item], point);
+          if (d < best && distance_squared) {
+            d = distance_squared(user, item, point);
+          }
+          if (d < best) {
+            best = d;
+            result = item;
+          }
+        }
+        continue;
+      }
+
+      // push the farther child first so the nearer one is searched first
+      const unsigned int left = node->first, right = node->first + 1;
+      const float left_d =
+          bvh__distance_squared(&tree->nodes[left].bounds, point);
+      const float right_d =
+          bvh__distance_squared(&tree->nodes[right].bounds, point);
+      stack[stack_count++] = left_d < right_d ? right : left;
+      stack[stack_count++] = left_d < right_d ? left : right;
+    }
+
+    bvh__stack_free(stack, local);
+  }
+
+  if (distance) {
+    *distance = result == BVH_NONE ? FLT_MAX : sqrtf(best);
+  }
+  return result;
+}
@@ -0,0 +1,102 @@
+/*--------------------------------------------------------------------------/
+  /                                                                           /
+  / bvh.h                                                                     /
+  / A bounding volume hierarchy over axis aligned boxes                       /
+  /                                                                           /
+  /--------------------------------------------------------------------------*/
+
+#ifndef BVH_H
+#define BVH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // ifdef __cplusplus
+
+#include "math3d.h"
+
+#define BVH_NONE (0xFFFFFFFFu)
+
+typedef struct {
+  vector3 min;
+  vector3 max;
+} bvh_aabb;
+
+// Inner nodes have count 0 and their children at first and first + 1. Leaves
+// hold count items starting at first in bvh.items. Children always come after
+// their parent in bvh.nodes.
+typedef struct {
+  bvh_aabb bounds;
+  unsigned int first;
+  unsigned int count;
+  unsigned int parent;
+} bvh_node;
+
+typedef struct {
+  bvh_node *nodes;
+  unsigned int node_count;
+  unsigned int node_capacity;
+
+  // item ids grouped by leaf
+  unsigned int *items;
+  // per item id: its bounds and the leaf holding it
+  bvh_aabb *item_bounds;
+  unsigned int *item_leaves;
+  unsigned int item_count;
+
+  // deepest leaf, sizes the traversal stacks
+  unsigned int depth;
+} bvh;
+
+// Called for every item a query reports.
+typedef void (*bvh_visit_function)(void *user, unsigned int item);
+
+// Exact tests against an item whose box passed. Return the hit distance along
+// the ray, or a negative number for a miss.
+typedef float (*bvh_ray_function)(void *user, unsigned int item,
+                                  vector3 origin, vector3 direction);
+// Return the squared distance between point and the item.
+typedef float (*bvh_distance_function)(void *user, unsigned int item,
+                                       vector3 point);
+
+bvh bvh_alloc(void);
+void bvh_free(bvh *tree);
+
+// Builds the tree over count items, item i bounded by items[i], using the
+// surface area heuristic over binned centroids.
+void bvh_build(bvh *tree, const bvh_aabb *items, unsigned int count);
+
+// Refits every node bottom up to new bounds of the same items, keeping the
+// topology. Much cheaper than bvh_build, but the tree degrades as items move
+// away from where it was built. Compare bvh_cost to its value after the build
+// to decide when to rebuild.
+void bvh_refit(bvh *tree, const bvh_aabb *items);
+
+// Moves one item and refits only the nodes above it, stopping at the first
+// node whose bounds do not change.
+void bvh_update(bvh *tree, unsigned int item, bvh_aabb bounds);
+
+// Surface area heuristic cost of the tree, relative to the root box.
+float bvh_cost(const bvh *tree);
+
+// Visits every item whose box is at least partially inside the 6 planes of
+// frustum_from_mat4. Subtrees fully inside are visited without more tests.
+void bvh_query_frustum(const bvh *tree, const vector4 *planes,
+                       bvh_visit_function visit, void *user);
+
+// Returns the closest item hit by the ray, or BVH_NONE, and its distance in
+// *distance. direction does not need to be normalized; distances are in
+// multiples of it. hit may be NULL to use the item boxes.
+unsigned int bvh_query_ray(const bvh *tree, vector3 origin, vector3 direction,
+                           bvh_ray_function hit, void *user, float *distance);
+
+// Returns the item closest to point, or BVH_NONE for an empty tree, and its
+// distance in *distance. distance_squared may be NULL to use the item boxes.
+unsigned int bvh_query_nearest(const bvh *tree, vector3 point,
+                               bvh_distance_function distance_squared,
+                               void *user, float *distance);
+
+#ifdef __cplusplus
+}
+#endif // ifdef __cplusplus
+
+#endif // BVH_H
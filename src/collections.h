@@ -45,12 +45,35 @@ typedef struct {
       const sc_list_size new_capacity = data->count * 2 + 1;                   \
       data = realloc(data, sizeof(sc_list_meta_data) +                         \
                                (sizeof(type) * new_capacity));                 \
+      data->capacity = new_capacity;                                           \
       *list = (sc_list_##type)(data + 1);                                      \
     }                                                                          \
     (*list)[data->count] = element;                                            \
     data->count++;                                                             \
   }                                                                            \
                                                                                \
+  static inline void sc_list_##type##_reserve(sc_list_##type *list,            \
+                                              const sc_list_size capacity) {   \
+    sc_list_meta_data *data = ((sc_list_meta_data *)(*list)) - 1;              \
+    if (capacity > data->capacity) {                                           \
+      data = realloc(data,                                                     \
+                     sizeof(sc_list_meta_data) + (sizeof(type) * capacity));   \
+      data->capacity = capacity;                                               \
+      *list = (sc_list_##type)(data + 1);                                      \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline void sc_list_##type##_resize(sc_list_##type *list,             \
+                                             const sc_list_size count) {       \
+    sc_list_##type##_reserve(list, count);                                     \
+    (((sc_list_meta_data *)(*list)) - 1)->count = count;                       \
+  }                                                                            \
+                                                                               \
+  static inline void sc_list_##type##_clear(const sc_list_##type list) {       \
+    sc_list_meta_data *data = ((sc_list_meta_data *)(list)) - 1;               \
+    data->count = 0;                                                           \
+  }                                                                            \
+                                                                               \
   static inline sc_list_##type sc_list_##type##_alloc_from_array(              \
       sc_list_##type other, sc_list_size length) {                             \
     sc_list_##type l = sc_list_##type##_alloc();                               \
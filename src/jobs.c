@@ -0,0 +1,273 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "jobs.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define JOBS__DEQUE_CAPACITY (256)
+
+typedef struct {
+  jobs_range_function function;
+  // set instead of function for tasks of jobs_submit
+  jobs_function background;
+  void *user;
+  size_t begin;
+  size_t end;
+  size_t grain;
+  atomic_size_t *remaining;
+} jobs__task;
+
+// the owner pushes and pops at the tail, thieves take from the head.
+typedef struct {
+  pthread_mutex_t lock;
+  jobs__task tasks[JOBS__DEQUE_CAPACITY];
+  size_t head;
+  size_t tail;
+} jobs__deque;
+
+static struct {
+  pthread_t *threads;
+  // one deque per worker plus deque 0 for threads outside the pool.
+  jobs__deque *deques;
+  // tasks of jobs_submit, taken oldest first by workers only.
+  jobs__deque background;
+  unsigned int thread_count;
+
+  pthread_mutex_t sleep_lock;
+  pthread_cond_t sleep_cond;
+  atomic_size_t pending;
+  atomic_int running;
+} jobs__pool = {0};
+
+static _Thread_local unsigned int jobs__slot = 0;
+
+static unsigned int jobs__core_count(void) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+#else
+  const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? (unsigned int)cores : 1;
+#endif
+}
+
+static int jobs__push(jobs__deque *deque, const jobs__task task) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->tail - deque->head >= JOBS__DEQUE_CAPACITY) {
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+  }
+  deque->tasks[deque->tail % JOBS__DEQUE_CAPACITY] = task;
+  deque->tail++;
+  pthread_mutex_unlock(&deque->lock);
+
+  pthread_mutex_lock(&jobs__pool.sleep_lock);
+  atomic_fetch_add(&jobs__pool.pending, 1);
+  pthread_cond_signal(&jobs__pool.sleep_cond);
+  pthread_mutex_unlock(&jobs__pool.sleep_lock);
+  return 1;
+}
+
+static int jobs__take(jobs__deque *deque, const int steal, jobs__task *task) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->tail == deque->head) {
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+  }
+  if (steal) {
+    *task = deque->tasks[deque->head % JOBS__DEQUE_CAPACITY];
+    deque->head++;
+  } else {
+    deque->tail--;
+    *task = deque->tasks[deque->tail % JOBS__DEQUE_CAPACITY];
+  }
+  pthread_mutex_unlock(&deque->lock);
+
+  atomic_fetch_sub(&jobs__pool.pending, 1);
+  return 1;
+}
+
+// pops from our own deque first, then steals from the others.
+static int jobs__find(jobs__task *task) {
+  if (jobs__take(&jobs__pool.deques[jobs__slot], 0, task)) {
+    return 1;
+  }
+
+  const unsigned int slots = jobs__pool.thread_count + 1;
+  for (unsigned int i = 1; i < slots; i++) {
+    if (jobs__take(&jobs__pool.deques[(jobs__slot + i) % slots], 1, task)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void jobs__execute(jobs__task task) {
+  // keep the lower half, offer the upper half to thieves.
+  while (task.end - task.begin > task.grain) {
+    jobs__task upper = task;
+    upper.begin = task.begin + (task.end - task.begin) / 2;
+    if (!jobs__push(&jobs__pool.deques[jobs__slot], upper)) {
+      break;
+    }
+    task.end = upper.begin;
+  }
+
+  task.function(task.user, task.begin, task.end);
+  atomic_fetch_sub(task.remaining, task.end - task.begin);
+}
+
+static void *jobs__worker(void *argument) {
+  jobs__slot = (unsigned int)(size_t)argument;
+
+  while (atomic_load(&jobs__pool.running)) {
+    jobs__task task;
+    if (jobs__find(&task)) {
+      jobs__execute(task);
+      continue;
+    }
+
+    // background tasks only once no range is left to help with
+    if (jobs__take(&jobs__pool.background, 1, &task)) {
+      task.background(task.user);
+      continue;
+    }
+
+    pthread_mutex_lock(&jobs__pool.sleep_lock);
+    while (atomic_load(&jobs__pool.pending) == 0 &&
+           atomic_load(&jobs__pool.running)) {
+      pthread_cond_wait(&jobs__pool.sleep_cond, &jobs__pool.sleep_lock);
+    }
+    pthread_mutex_unlock(&jobs__pool.sleep_lock);
+  }
+
+  return NULL;
+}
+
+void jobs_start(unsigned int thread_count) {
+  if (jobs__pool.deques) {
+    debug_warn("Job system already started");
+    return;
+  }
+
+  if (thread_count == 0) {
+    thread_count = jobs__core_count() - 1;
+  }
+
+  jobs__pool.thread_count = thread_count;
+  jobs__pool.threads = calloc(sizeof(*jobs__pool.threads), thread_count + 1);
+  jobs__pool.deques = calloc(sizeof(*jobs__pool.deques), thread_count + 1);
+  atomic_store(&jobs__pool.pending, 0);
+  atomic_store(&jobs__pool.running, 1);
+
+  pthread_mutex_init(&jobs__pool.sleep_lock, NULL);
+  pthread_cond_init(&jobs__pool.sleep_cond, NULL);
+
+  for (unsigned int i = 0; i < thread_count + 1; i++) {
+    pthread_mutex_init(&jobs__pool.deques[i].lock, NULL);
+  }
+  pthread_mutex_init(&jobs__pool.background.lock, NULL);
+  jobs__pool.background.head = 0;
+  jobs__pool.background.tail = 0;
+
+  for (unsigned int i = 0; i < thread_count; i++) {
+    if (pthread_create(&jobs__pool.threads[i], NULL, jobs__worker,
+                       (void *)(size_t)(i + 1)) != 0) {
+      debug_error("Failed to create job thread %u", i);
+      jobs__pool.thread_count = i;
+      break;
+    }
+  }
+
+  debug_log("Job system started with %u worker threads",
+            jobs__pool.thread_count);
+}
+
+void jobs_free(void) {
+  if (jobs__pool.deques == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&jobs__pool.sleep_lock);
+  atomic_store(&jobs__pool.running, 0);
+  pthread_cond_broadcast(&jobs__pool.sleep_cond);
+  pthread_mutex_unlock(&jobs__pool.sleep_lock);
+
+  for (unsigned int i = 0; i < jobs__pool.thread_count; i++) {
+    pthread_join(jobs__pool.threads[i], NULL);
+  }
+
+  // background tasks still queued are dropped, their owners free them
+  jobs__pool.background.head = 0;
+  jobs__pool.background.tail = 0;
+  pthread_mutex_destroy(&jobs__pool.background.lock);
+
+  for (unsigned int i = 0; i < jobs__pool.thread_count + 1; i++) {
+    pthread_mutex_destroy(&jobs__pool.deques[i].lock);
+  }
+
+  pthread_mutex_destroy(&jobs__pool.sleep_lock);
+  pthread_cond_destroy(&jobs__pool.sleep_cond);
+
+  free(jobs__pool.threads);
+  free(jobs__pool.deques);
+  jobs__pool.threads = NULL;
+  jobs__pool.deques = NULL;
+  jobs__pool.thread_count = 0;
+}
+
+unsigned int jobs_thread_count(void) { return jobs__pool.thread_count; }
+
+void jobs_parallel_for(size_t count, size_t grain, jobs_range_function function,
+                       void *user) {
+  if (grain == 0) {
+    grain = 1;
+  }
+
+  if (jobs__pool.thread_count == 0 || count <= grain) {
+    function(user, 0, count);
+    return;
+  }
+
+  atomic_size_t remaining;
+  atomic_init(&remaining, count);
+
+  jobs__execute((jobs__task){
+      .function = function,
+      .user = user,
+      .begin = 0,
+      .end = count,
+      .grain = grain,
+      .remaining = &remaining,
+  });
+
+  // help out until every range of this call is done.
+  while (atomic_load(&remaining) > 0) {
+    jobs__task task;
+    if (jobs__find(&task)) {
+      jobs__execute(task);
+    } else {
+      sched_yield();
+    }
+  }
+}
+
+void jobs_submit(jobs_function function, void *user) {
+  const jobs__task task = {.background = function, .user = user};
+  if (jobs__pool.thread_count == 0 ||
+      !jobs__push(&jobs__pool.background, task)) {
+    function(user);
+  }
+}
@@ -0,0 +1,49 @@
+/*--------------------------------------------------------------------------/
+  /                                                                           /
+  / jobs.h                                                                    /
+  / A small work-stealing job system                                          /
+  /                                                                           /
+  /--------------------------------------------------------------------------*/
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // ifdef __cplusplus
+
+#include <stddef.h>
+
+// Processes the items in [begin, end). Called concurrently from several
+// threads with disjoint ranges.
+typedef void (*jobs_range_function)(void *user, size_t begin, size_t end);
+
+// A task run once by jobs_submit.
+typedef void (*jobs_function)(void *user);
+
+// Starts thread_count worker threads. Pass 0 to use one worker per core,
+// minus the calling thread which also works while it waits.
+void jobs_start(unsigned int thread_count);
+void jobs_free(void);
+
+unsigned int jobs_thread_count(void);
+
+// Calls function over [0, count) split into ranges of at least grain items and
+// returns once every range is done. Ranges are split in halves on demand and
+// idle threads steal the halves, so uneven work balances itself. Runs inline
+// when the pool is not started or count <= grain.
+void jobs_parallel_for(size_t count, size_t grain, jobs_range_function function,
+                       void *user);
+
+// Queues function to run once on a worker and returns at once. Only workers
+// take these tasks, so a thread waiting in jobs_parallel_for never ends up
+// running a long one. Runs inline when the pool has no workers or the queue
+// is full. jobs_free drops the tasks still queued without running them and
+// waits for the running ones to finish.
+void jobs_submit(jobs_function function, void *user);
+
+#ifdef __cplusplus
+}
+#endif // ifdef __cplusplus
+
+#endif // JOBS_H
@@ -3,6 +3,22 @@
 
 #include "mathf.h"
 
+// SIMD width used by the batch kernels. Define MATH_3D_NO_SIMD to force the
+// scalar fallback.
+#if !defined(MATH_3D_NO_SIMD) && defined(__AVX__)
+#include <immintrin.h>
+#define MATH_3D_SIMD_WIDTH 8
+#elif !defined(MATH_3D_NO_SIMD) &&                                             \
+    (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+#include <emmintrin.h>
+#define MATH_3D_SIMD_WIDTH 4
+#elif !defined(MATH_3D_NO_SIMD) && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define MATH_3D_SIMD_WIDTH 4
+#else
+#define MATH_3D_SIMD_WIDTH 1
+#endif
+
 // For added convenience, you can use printf(vector3_TO_STRING(vec)) .
 #define VECTOR2_TO_STRING(v) "{%f, %f}", v.x, v.y
 #define VECTOR3_TO_STRING(v) "{%f, %f, %f}", v.x, v.y, v.z
@@ -157,6 +173,7 @@ MATH_3D_API vector4 vector4_add(vector4 a, vector4 b) {
       .x = a.x + b.x,
       .y = a.y + b.y,
       .z = a.z + b.z,
+      .w = a.w + b.w,
   };
 }
 
@@ -183,6 +200,7 @@ MATH_3D_API vector4 vector4_sub(vector4 a, vector4 b) {
       .x = a.x - b.x,
       .y = a.y - b.y,
       .z = a.z - b.z,
+      .w = a.w - b.w,
   };
 }
 
@@ -576,4 +594,486 @@ MATH_3D_API float *quaternion_to_mat4(vector4 q, float *mat) {
   return mat;
 }
 
+// Writes translation * rotation * scale directly into m without building the
+// three intermediate matrices. ~30 flops instead of two mat4_multiply calls.
+MATH_3D_API void mat4_from_trs(float *m, const vector3 position,
+                               const vector4 rotation, const vector3 scale) {
+  const float x = rotation.x, y = rotation.y, z = rotation.z, w = rotation.w;
+
+  const float xx = x * x * 2, xy = x * y * 2, xz = x * z * 2, xw = x * w * 2,
+              yy = y * y * 2, yz = y * z * 2, yw = y * w * 2, zz = z * z * 2,
+              zw = z * w * 2;
+
+  m[0] = scale.x * (1 - (yy + zz));
+  m[1] = scale.x * (xy + zw);
+  m[2] = scale.x * (xz - yw);
+  m[3] = 0;
+
+  m[4] = scale.y * (xy - zw);
+  m[5] = scale.y * (1 - (xx + zz));
+  m[6] = scale.y * (yz + xw);
+  m[7] = 0;
+
+  m[8] = scale.z * (xz + yw);
+  m[9] = scale.z * (yz - xw);
+  m[10] = scale.z * (1 - (xx + yy));
+  m[11] = 0;
+
+  m[12] = position.x;
+  m[13] = position.y;
+  m[14] = position.z;
+  m[15] = 1;
+}
+
+// Writes the inverse of translation * rotation into m, i.e. a view matrix for
+// an object at position with the given rotation. The rotation is transposed
+// and the translation rotated back instead of inverting a general matrix.
+MATH_3D_API void mat4_from_rt_inverse(float *m, const vector3 position,
+                                      const vector4 rotation) {
+  mat4_from_trs(m, (vector3){0, 0, 0}, quaternion_conjugate(rotation),
+                (vector3){1, 1, 1});
+
+  m[12] = -(m[0] * position.x + m[4] * position.y + m[8] * position.z);
+  m[13] = -(m[1] * position.x + m[5] * position.y + m[9] * position.z);
+  m[14] = -(m[2] * position.x + m[6] * position.y + m[10] * position.z);
+}
+
+// Separate streams of position, rotation (quaternion) and scale components,
+// one float per instance in each. stride is the distance in floats between two
+// consecutive instances: 1 for tightly packed arrays, or the size of the
+// struct when pointing into an array of structs.
+typedef struct {
+  const float *position[3];
+  const float *rotation[4];
+  const float *scale[3];
+  size_t stride;
+} mat4_trs_streams;
+
+#if MATH_3D_SIMD_WIDTH == 8
+
+typedef __m256 mat4__simd;
+#define mat4__simd_set1 _mm256_set1_ps
+#define mat4__simd_add _mm256_add_ps
+#define mat4__simd_sub _mm256_sub_ps
+#define mat4__simd_mul _mm256_mul_ps
+#define mat4__simd_min _mm256_min_ps
+#define mat4__simd_max _mm256_max_ps
+#define mat4__simd_sqrt _mm256_sqrt_ps
+#define mat4__simd_store _mm256_storeu_ps
+
+MATH_3D_API mat4__simd mat4__simd_load(const float *p, const size_t stride) {
+  if (stride == 1) {
+    return _mm256_loadu_ps(p);
+  }
+  return _mm256_set_ps(p[7 * stride], p[6 * stride], p[5 * stride],
+                       p[4 * stride], p[3 * stride], p[2 * stride], p[stride],
+                       p[0]);
+}
+
+// transposes one column of 8 matrices from lanes to memory.
+MATH_3D_API void mat4__simd_store_column(float *out, const mat4__simd r0,
+                                         const mat4__simd r1,
+                                         const mat4__simd r2,
+                                         const mat4__simd r3) {
+  const __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+  const __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+  const __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+  const __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+  const __m256 c0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+  const __m256 c1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+  const __m256 c2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  const __m256 c3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+  _mm_storeu_ps(out + 0 * 16, _mm256_castps256_ps128(c0));
+  _mm_storeu_ps(out + 1 * 16, _mm256_castps256_ps128(c1));
+  _mm_storeu_ps(out + 2 * 16, _mm256_castps256_ps128(c2));
+  _mm_storeu_ps(out + 3 * 16, _mm256_castps256_ps128(c3));
+  _mm_storeu_ps(out + 4 * 16, _mm256_extractf128_ps(c0, 1));
+  _mm_storeu_ps(out + 5 * 16, _mm256_extractf128_ps(c1, 1));
+  _mm_storeu_ps(out + 6 * 16, _mm256_extractf128_ps(c2, 1));
+  _mm_storeu_ps(out + 7 * 16, _mm256_extractf128_ps(c3, 1));
+}
+
+#elif MATH_3D_SIMD_WIDTH == 4 && defined(__ARM_NEON)
+
+typedef float32x4_t mat4__simd;
+#define mat4__simd_set1 vdupq_n_f32
+#define mat4__simd_add vaddq_f32
+#define mat4__simd_sub vsubq_f32
+#define mat4__simd_mul vmulq_f32
+#define mat4__simd_min vminq_f32
+#define mat4__simd_max vmaxq_f32
+#define mat4__simd_sqrt vsqrtq_f32
+#define mat4__simd_store vst1q_f32
+
+MATH_3D_API mat4__simd mat4__simd_load(const float *p, const size_t stride) {
+  if (stride == 1) {
+    return vld1q_f32(p);
+  }
+  const float lanes[4] = {p[0], p[stride], p[2 * stride], p[3 * stride]};
+  return vld1q_f32(lanes);
+}
+
+// transposes one column of 4 matrices from lanes to memory.
+MATH_3D_API void mat4__simd_store_column(float *out, const mat4__simd r0,
+                                         const mat4__simd r1,
+                                         const mat4__simd r2,
+                                         const mat4__simd r3) {
+  const float32x4x2_t a = vtrnq_f32(r0, r1);
+  const float32x4x2_t b = vtrnq_f32(r2, r3);
+  vst1q_f32(out + 0 * 16,
+            vcombine_f32(vget_low_f32(a.val[0]), vget_low_f32(b.val[0])));
+  vst1q_f32(out + 1 * 16,
+            vcombine_f32(vget_low_f32(a.val[1]), vget_low_f32(b.val[1])));
+  vst1q_f32(out + 2 * 16,
+            vcombine_f32(vget_high_f32(a.val[0]), vget_high_f32(b.val[0])));
+  vst1q_f32(out + 3 * 16,
+            vcombine_f32(vget_high_f32(a.val[1]), vget_high_f32(b.val[1])));
+}
+
+#elif MATH_3D_SIMD_WIDTH == 4
+
+typedef __m128 mat4__simd;
+#define mat4__simd_set1 _mm_set1_ps
+#define mat4__simd_add _mm_add_ps
+#define mat4__simd_sub _mm_sub_ps
+#define mat4__simd_mul _mm_mul_ps
+#define mat4__simd_min _mm_min_ps
+#define mat4__simd_max _mm_max_ps
+#define mat4__simd_sqrt _mm_sqrt_ps
+#define mat4__simd_store _mm_storeu_ps
+
+MATH_3D_API mat4__simd mat4__simd_load(const float *p, const size_t stride) {
+  if (stride == 1) {
+    return _mm_loadu_ps(p);
+  }
+  return _mm_set_ps(p[3 * stride], p[2 * stride], p[stride], p[0]);
+}
+
+// transposes one column of 4 matrices from lanes to memory.
+MATH_3D_API void mat4__simd_store_column(float *out, mat4__simd r0,
+                                         mat4__simd r1, mat4__simd r2,
+                                         mat4__simd r3) {
+  _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+  _mm_storeu_ps(out + 0 * 16, r0);
+  _mm_storeu_ps(out + 1 * 16, r1);
+  _mm_storeu_ps(out + 2 * 16, r2);
+  _mm_storeu_ps(out + 3 * 16, r3);
+}
+
+#endif // MATH_3D_SIMD_WIDTH
+
+// Composes count translation * rotation * scale transforms into count
+// column-major 4x4 matrices written contiguously to out. Processes
+// MATH_3D_SIMD_WIDTH instances per iteration, the remainder is done in scalar.
+MATH_3D_API void mat4_from_trs_batch(float *out, const mat4_trs_streams *in,
+                                     const size_t count) {
+  const size_t s = in->stride;
+  size_t i = 0;
+
+#if MATH_3D_SIMD_WIDTH > 1
+  const mat4__simd zero = mat4__simd_set1(0.0f);
+  const mat4__simd one = mat4__simd_set1(1.0f);
+  const mat4__simd two = mat4__simd_set1(2.0f);
+
+  for (; i + MATH_3D_SIMD_WIDTH <= count; i += MATH_3D_SIMD_WIDTH) {
+    const size_t o = i * s;
+    const mat4__simd x = mat4__simd_load(in->rotation[0] + o, s);
+    const mat4__simd y = mat4__simd_load(in->rotation[1] + o, s);
+    const mat4__simd z = mat4__simd_load(in->rotation[2] + o, s);
+    const mat4__simd w = mat4__simd_load(in->rotation[3] + o, s);
+
+    const mat4__simd x2 = mat4__simd_mul(x, two);
+    const mat4__simd y2 = mat4__simd_mul(y, two);
+    const mat4__simd z2 = mat4__simd_mul(z, two);
+
+    const mat4__simd xx = mat4__simd_mul(x, x2), xy = mat4__simd_mul(x, y2),
+                     xz = mat4__simd_mul(x, z2), xw = mat4__simd_mul(w, x2),
+                     yy = mat4__simd_mul(y, y2), yz = mat4__simd_mul(y, z2),
+                     yw = mat4__simd_mul(w, y2), zz = mat4__simd_mul(z, z2),
+                     zw = mat4__simd_mul(w, z2);
+
+    const mat4__simd sx = mat4__simd_load(in->scale[0] + o, s);
+    const mat4__simd sy = mat4__simd_load(in->scale[1] + o, s);
+    const mat4__simd sz = mat4__simd_load(in->scale[2] + o, s);
+
+    float *m = out + i * 16;
+
+    mat4__simd_store_column(
+        m + 0,
+        mat4__simd_mul(sx, mat4__simd_sub(one, mat4__simd_add(yy, zz))),
+        mat4__simd_mul(sx, mat4__simd_add(xy, zw)),
+        mat4__simd_mul(sx, mat4__simd_sub(xz, yw)), zero);
+
+    mat4__simd_store_column(
+        m + 4, mat4__simd_mul(sy, mat4__simd_sub(xy, zw)),
+        mat4__simd_mul(sy, mat4__simd_sub(one, mat4__simd_add(xx, zz))),
+        mat4__simd_mul(sy, mat4__simd_add(yz, xw)), zero);
+
+    mat4__simd_store_column(
+        m + 8, mat4__simd_mul(sz, mat4__simd_add(xz, yw)),
+        mat4__simd_mul(sz, mat4__simd_sub(yz, xw)),
+        mat4__simd_mul(sz, mat4__simd_sub(one, mat4__simd_add(xx, yy))), zero);
+
+    mat4__simd_store_column(m + 12, mat4__simd_load(in->position[0] + o, s),
+                            mat4__simd_load(in->position[1] + o, s),
+                            mat4__simd_load(in->position[2] + o, s), one);
+  }
+#endif // MATH_3D_SIMD_WIDTH > 1
+
+  for (; i < count; i++) {
+    const size_t o = i * s;
+    mat4_from_trs(out + i * 16,
+                  (vector3){in->position[0][o], in->position[1][o],
+                            in->position[2][o]},
+                  (vector4){in->rotation[0][o], in->rotation[1][o],
+                            in->rotation[2][o], in->rotation[3][o]},
+                  (vector3){in->scale[0][o], in->scale[1][o], in->scale[2][o]});
+  }
+}
+
+// Extracts the 6 frustum planes (a, b, c, d) of the column-major clip matrix m
+// into planes: left, right, bottom, top, near, far. Normals point inwards and
+// are normalized, so dot((a, b, c), p) + d is the signed distance of p.
+MATH_3D_API void frustum_from_mat4(vector4 *planes, const float *m) {
+  for (int i = 0; i < 3; i++) {
+    const vector4 row = {m[i], m[4 + i], m[8 + i], m[12 + i]};
+    const vector4 w = {m[3], m[7], m[11], m[15]};
+    planes[i * 2 + 0] = vector4_add(w, row);
+    planes[i * 2 + 1] = vector4_sub(w, row);
+  }
+
+  for (int i = 0; i < 6; i++) {
+    const float length = vector3_magnitude(
+        (vector3){planes[i].x, planes[i].y, planes[i].z});
+    if (length > 0) {
+      planes[i] = vector4_scaled(planes[i], 1 / length);
+    }
+  }
+}
+
+// Transforms the sphere (center, radius) by each of count column-major
+// matrices stored contiguously in matrices, the radius by the largest axis
+// scale, and tests it against the 6 planes of frustum_from_mat4. Writes the
+// index of every sphere that is at least partially inside to visible, in
+// order, and returns how many were written. MATH_3D_SIMD_WIDTH spheres are
+// tested per iteration.
+MATH_3D_API size_t frustum_cull_spheres(unsigned int *visible,
+                                        const float *matrices,
+                                        const size_t count,
+                                        const vector4 *planes,
+                                        const vector3 center,
+                                        const float radius) {
+  size_t visible_count = 0;
+  size_t i = 0;
+
+#if MATH_3D_SIMD_WIDTH > 1
+  const mat4__simd cx = mat4__simd_set1(center.x);
+  const mat4__simd cy = mat4__simd_set1(center.y);
+  const mat4__simd cz = mat4__simd_set1(center.z);
+  const mat4__simd r = mat4__simd_set1(radius);
+
+  for (; i + MATH_3D_SIMD_WIDTH <= count; i += MATH_3D_SIMD_WIDTH) {
+    const float *m = matrices + i * 16;
+    mat4__simd c[12];
+    for (int k = 0; k < 12; k++) {
+      c[k] = mat4__simd_load(m + k + k / 3, 16);
+    }
+    // c holds m[0..2], m[4..6], m[8..10] and m[12..14]: the three scaled axes
+    // and the translation.
+
+    const mat4__simd x = mat4__simd_add(
+        c[9], mat4__simd_add(mat4__simd_mul(c[0], cx),
+                             mat4__simd_add(mat4__simd_mul(c[3], cy),
+                                            mat4__simd_mul(c[6], cz))));
+    const mat4__simd y = mat4__simd_add(
+        c[10], mat4__simd_add(mat4__simd_mul(c[1], cx),
+                              mat4__simd_add(mat4__simd_mul(c[4], cy),
+                                             mat4__simd_mul(c[7], cz))));
+    const mat4__simd z = mat4__simd_add(
+        c[11], mat4__simd_add(mat4__simd_mul(c[2], cx),
+                              mat4__simd_add(mat4__simd_mul(c[5], cy),
+                                             mat4__simd_mul(c[8], cz))));
+
+    mat4__simd scale = mat4__simd_set1(0.0f);
+    for (int axis = 0; axis < 3; axis++) {
+      const mat4__simd a = c[axis * 3 + 0], b = c[axis * 3 + 1],
+                       d = c[axis * 3 + 2];
+      scale = mat4__simd_max(
+          scale, mat4__simd_add(mat4__simd_mul(a, a),
+                                mat4__simd_add(mat4__simd_mul(b, b),
+                                               mat4__simd_mul(d, d))));
+    }
+    const mat4__simd world_radius = mat4__simd_mul(r, mat4__simd_sqrt(scale));
+
+    // smallest distance over all planes, pushed out by the radius. the sphere
+    // is visible unless it is fully behind one of the planes.
+    mat4__simd distance = mat4__simd_set1(3.402823466e+38f);
+    for (int p = 0; p < 6; p++) {
+      const mat4__simd plane = mat4__simd_add(
+          mat4__simd_add(mat4__simd_mul(x, mat4__simd_set1(planes[p].x)),
+                         mat4__simd_mul(y, mat4__simd_set1(planes[p].y))),
+          mat4__simd_add(mat4__simd_mul(z, mat4__simd_set1(planes[p].z)),
+                         mat4__simd_set1(planes[p].w)));
+      distance = mat4__simd_min(distance, mat4__simd_add(plane, world_radius));
+    }
+
+    float lanes[MATH_3D_SIMD_WIDTH];
+    mat4__simd_store(lanes, distance);
+    for (int lane = 0; lane < MATH_3D_SIMD_WIDTH; lane++) {
+      if (lanes[lane] >= 0) {
+        visible[visible_count++] = (unsigned int)(i + lane);
+      }
+    }
+  }
+#endif // MATH_3D_SIMD_WIDTH > 1
+
+  for (; i < count; i++) {
+    const float *m = matrices + i * 16;
+    const vector3 world = {
+        m[12] + m[0] * center.x + m[4] * center.y + m[8] * center.z,
+        m[13] + m[1] * center.x + m[5] * center.y + m[9] * center.z,
+        m[14] + m[2] * center.x + m[6] * center.y + m[10] * center.z,
+    };
+
+    float scale = 0;
+    for (int axis = 0; axis < 3; axis++) {
+      const float *a = m + axis * 4;
+      scale = fmaxf(scale, a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+    }
+    const float world_radius = radius * sqrtf(scale);
+
+    int inside = 1;
+    for (int p = 0; p < 6 && inside; p++) {
+      inside = planes[p].x * world.x + planes[p].y * world.y +
+                   planes[p].z * world.z + planes[p].w + world_radius >=
+               0;
+    }
+
+    if (inside) {
+      visible[visible_count++] = (unsigned int)i;
+    }
+  }
+
+  return visible_count;
+}
+
+// Tests the sphere (center, radius) of count translation * rotation * scale
+// transforms against the 6 planes of frustum_from_mat4, like
+// frustum_cull_spheres but straight from the transform streams: the scaled
+// center is rotated by the quaternion and the radius grows by the largest
+// absolute scale. Writes the index of every sphere that is at least partially
+// inside to visible, in order, and returns how many were written.
+MATH_3D_API size_t frustum_cull_trs_spheres(unsigned int *visible,
+                                            const mat4_trs_streams *in,
+                                            const size_t count,
+                                            const vector4 *planes,
+                                            const vector3 center,
+                                            const float radius) {
+  const size_t s = in->stride;
+  size_t visible_count = 0;
+  size_t i = 0;
+
+#if MATH_3D_SIMD_WIDTH > 1
+  const mat4__simd zero = mat4__simd_set1(0.0f);
+  const mat4__simd two = mat4__simd_set1(2.0f);
+  const mat4__simd r = mat4__simd_set1(radius);
+
+  for (; i + MATH_3D_SIMD_WIDTH <= count; i += MATH_3D_SIMD_WIDTH) {
+    const size_t o = i * s;
+    const mat4__simd sx = mat4__simd_load(in->scale[0] + o, s);
+    const mat4__simd sy = mat4__simd_load(in->scale[1] + o, s);
+    const mat4__simd sz = mat4__simd_load(in->scale[2] + o, s);
+    const mat4__simd qx = mat4__simd_load(in->rotation[0] + o, s);
+    const mat4__simd qy = mat4__simd_load(in->rotation[1] + o, s);
+    const mat4__simd qz = mat4__simd_load(in->rotation[2] + o, s);
+    const mat4__simd qw = mat4__simd_load(in->rotation[3] + o, s);
+
+    const mat4__simd cx = mat4__simd_mul(sx, mat4__simd_set1(center.x));
+    const mat4__simd cy = mat4__simd_mul(sy, mat4__simd_set1(center.y));
+    const mat4__simd cz = mat4__simd_mul(sz, mat4__simd_set1(center.z));
+
+    // c + w t + q x t with t = 2 q x c rotates c by the unit quaternion q
+    const mat4__simd tx = mat4__simd_mul(
+        two, mat4__simd_sub(mat4__simd_mul(qy, cz), mat4__simd_mul(qz, cy)));
+    const mat4__simd ty = mat4__simd_mul(
+        two, mat4__simd_sub(mat4__simd_mul(qz, cx), mat4__simd_mul(qx, cz)));
+    const mat4__simd tz = mat4__simd_mul(
+        two, mat4__simd_sub(mat4__simd_mul(qx, cy), mat4__simd_mul(qy, cx)));
+
+    const mat4__simd x = mat4__simd_add(
+        mat4__simd_load(in->position[0] + o, s),
+        mat4__simd_add(
+            mat4__simd_add(cx, mat4__simd_mul(qw, tx)),
+            mat4__simd_sub(mat4__simd_mul(qy, tz), mat4__simd_mul(qz, ty))));
+    const mat4__simd y = mat4__simd_add(
+        mat4__simd_load(in->position[1] + o, s),
+        mat4__simd_add(
+            mat4__simd_add(cy, mat4__simd_mul(qw, ty)),
+            mat4__simd_sub(mat4__simd_mul(qz, tx), mat4__simd_mul(qx, tz))));
+    const mat4__simd z = mat4__simd_add(
+        mat4__simd_load(in->position[2] + o, s),
+        mat4__simd_add(
+            mat4__simd_add(cz, mat4__simd_mul(qw, tz)),
+            mat4__simd_sub(mat4__simd_mul(qx, ty), mat4__simd_mul(qy, tx))));
+
+    const mat4__simd scale = mat4__simd_max(
+        mat4__simd_max(mat4__simd_max(sx, mat4__simd_sub(zero, sx)),
+                       mat4__simd_max(sy, mat4__simd_sub(zero, sy))),
+        mat4__simd_max(sz, mat4__simd_sub(zero, sz)));
+    const mat4__simd world_radius = mat4__simd_mul(r, scale);
+
+    mat4__simd distance = mat4__simd_set1(3.402823466e+38f);
+    for (int p = 0; p < 6; p++) {
+      const mat4__simd plane = mat4__simd_add(
+          mat4__simd_add(mat4__simd_mul(x, mat4__simd_set1(planes[p].x)),
+                         mat4__simd_mul(y, mat4__simd_set1(planes[p].y))),
+          mat4__simd_add(mat4__simd_mul(z, mat4__simd_set1(planes[p].z)),
+                         mat4__simd_set1(planes[p].w)));
+      distance = mat4__simd_min(distance, mat4__simd_add(plane, world_radius));
+    }
+
+    float lanes[MATH_3D_SIMD_WIDTH];
+    mat4__simd_store(lanes, distance);
+    // written unconditionally and kept by advancing the count, visibility is
+    // too random to branch on. never past i + lane, so count entries suffice.
+    for (int lane = 0; lane < MATH_3D_SIMD_WIDTH; lane++) {
+      visible[visible_count] = (unsigned int)(i + lane);
+      visible_count += lanes[lane] >= 0;
+    }
+  }
+#endif // MATH_3D_SIMD_WIDTH > 1
+
+  for (; i < count; i++) {
+    const size_t o = i * s;
+    const vector3 scale = {in->scale[0][o], in->scale[1][o], in->scale[2][o]};
+    const vector3 q = {in->rotation[0][o], in->rotation[1][o],
+                       in->rotation[2][o]};
+    const vector3 c = {center.x * scale.x, center.y * scale.y,
+                       center.z * scale.z};
+    const vector3 t = vector3_scaled(vector3_cross(q, c), 2);
+    const vector3 rotated =
+        vector3_add(c, vector3_add(vector3_scaled(t, in->rotation[3][o]),
+                                   vector3_cross(q, t)));
+    const vector3 world = {in->position[0][o] + rotated.x,
+                           in->position[1][o] + rotated.y,
+                           in->position[2][o] + rotated.z};
+    const float world_radius =
+        radius *
+        fmaxf(fabsf(scale.x), fmaxf(fabsf(scale.y), fabsf(scale.z)));
+
+    int inside = 1;
+    for (int p = 0; p < 6 && inside; p++) {
+      inside = planes[p].x * world.x + planes[p].y * world.y +
+                   planes[p].z * world.z + planes[p].w + world_radius >=
+               0;
+    }
+
+    if (inside) {
+      visible[visible_count++] = (unsigned int)i;
+    }
+  }
+
+  return visible_count;
+}
+
 #endif // MATH_3D_H
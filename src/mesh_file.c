@@ -0,0 +1,293 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mesh_file.h"
+#include "file.h"
+#include "log.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define MESH_FILE__MAGIC "LEMF"
+// bump whenever the layout or the order meshes are written in changes
+#define MESH_FILE__VERSION (2)
+
+// 64 bytes, so the vertex stream that follows stays aligned
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint64_t source_hash;
+  uint32_t vertex_count;
+  uint32_t vertex_size;
+  uint32_t index_count;
+  uint32_t index_size;
+  float bounds_center[3];
+  float bounds_radius;
+} mesh_file__header;
+
+static uint64_t mesh_file__hash(const char *text, const size_t length) {
+  uint64_t hash = 0xCBF29CE484222325ull ^ length;
+  size_t i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, text + i, sizeof(word));
+    hash = (hash ^ word) * 0x100000001B3ull;
+    hash ^= hash >> 29;
+  }
+  for (; i < length; i++) {
+    hash = (hash ^ (unsigned char)text[i]) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+static int mesh_file__stat(const char *source, uint64_t *size,
+                           int64_t *mtime) {
+  struct stat info;
+  if (stat(source, &info) != 0) {
+    return 0;
+  }
+  *size = (uint64_t)info.st_size;
+  *mtime = (int64_t)info.st_mtime;
+  return 1;
+}
+
+static void *mesh_file__map(const char *path, size_t *size) {
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  LARGE_INTEGER file_size;
+  HANDLE mapping = NULL;
+  void *view = NULL;
+  if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  }
+  if (mapping) {
+    view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    *size = (size_t)file_size.QuadPart;
+    // the view keeps the mapping alive
+    CloseHandle(mapping);
+  }
+  CloseHandle(file);
+  return view;
+#else
+  const int file = open(path, O_RDONLY);
+  if (file < 0) {
+    return NULL;
+  }
+
+  struct stat info;
+  void *view = NULL;
+  if (fstat(file, &info) == 0 && info.st_size > 0) {
+    view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (view == MAP_FAILED) {
+      view = NULL;
+    }
+    *size = (size_t)info.st_size;
+  }
+  close(file);
+  return view;
+#endif
+}
+
+static void mesh_file__unmap(void *mapping, const size_t size) {
+#ifdef _WIN32
+  (void)size;
+  UnmapViewOfFile(mapping);
+#else
+  munmap(mapping, size);
+#endif
+}
+
+// true if source is still what the header of the file at path was written
+// from. a source that was only touched has its new time stamped into the file,
+// so the content is hashed once and not on every load.
+static int mesh_file__fresh(const mesh_file__header *header, const char *path,
+                            const char *source) {
+  uint64_t size;
+  int64_t mtime;
+  if (!mesh_file__stat(source, &size, &mtime) ||
+      size != header->source_size) {
+    return 0;
+  }
+  if (mtime == header->source_mtime) {
+    return 1;
+  }
+
+  const file_buffer text = file_buffer_alloc(source);
+  if (text.error) {
+    return 0;
+  }
+  const int same =
+      mesh_file__hash(text.text, text.length) == header->source_hash;
+  file_buffer_free(text);
+
+  FILE *file = same ? fopen(path, "r+b") : NULL;
+  if (file) {
+    fseek(file, offsetof(mesh_file__header, source_mtime), SEEK_SET);
+    fwrite(&mtime, sizeof(mtime), 1, file);
+    fclose(file);
+  }
+  return same;
+}
+
+// true if every index of the file names one of its vertices. the largest index
+// is found first, so the loop has no early exit to keep it from vectorizing.
+static int mesh_file__indices_valid(const mesh_file__header *header) {
+  const char *indices = (const char *)(header + 1) +
+                        (size_t)header->vertex_count * header->vertex_size;
+  uint32_t largest = 0;
+  if (header->index_size == 2) {
+    for (uint32_t i = 0; i < header->index_count; i++) {
+      uint16_t index;
+      memcpy(&index, indices + (size_t)i * 2, sizeof(index));
+      largest = index > largest ? index : largest;
+    }
+  } else {
+    for (uint32_t i = 0; i < header->index_count; i++) {
+      uint32_t index;
+      memcpy(&index, indices + (size_t)i * 4, sizeof(index));
+      largest = index > largest ? index : largest;
+    }
+  }
+  return header->index_count == 0 || largest < header->vertex_count;
+}
+
+int mesh_file_open(mesh_file *file, const char *path, const char *source,
+                   const uint32_t vertex_size) {
+  size_t size = 0;
+  void *mapping = mesh_file__map(path, &size);
+  if (mapping == NULL) {
+    return 0;
+  }
+
+  const mesh_file__header *header = mapping;
+  if (size < sizeof(*header) ||
+      memcmp(header->magic, MESH_FILE__MAGIC, 4) != 0 ||
+      header->version != MESH_FILE__VERSION ||
+      header->vertex_size != vertex_size ||
+      (header->index_size != 2 && header->index_size != 4) ||
+      size < sizeof(*header) +
+                 (uint64_t)header->vertex_count * header->vertex_size +
+                 (uint64_t)header->index_count * header->index_size) {
+    debug_warn("Ignoring malformed or outdated mesh file %s", path);
+    mesh_file__unmap(mapping, size);
+    return 0;
+  }
+
+  if (!mesh_file__indices_valid(header)) {
+    debug_warn("Ignoring mesh file %s, an index is out of range", path);
+    mesh_file__unmap(mapping, size);
+    return 0;
+  }
+
+  if (!mesh_file__fresh(header, path, source)) {
+    mesh_file__unmap(mapping, size);
+    return 0;
+  }
+
+  const char *data = (const char *)(header + 1);
+  *file = (mesh_file){
+      .vertex_count = header->vertex_count,
+      .vertex_size = header->vertex_size,
+      .index_count = header->index_count,
+      .index_size = header->index_size,
+      .bounds_center = {header->bounds_center[0], header->bounds_center[1],
+                        header->bounds_center[2]},
+      .bounds_radius = header->bounds_radius,
+      .vertices = data,
+      .indices = data + (size_t)header->vertex_count * header->vertex_size,
+      .mapping = mapping,
+      .mapping_size = size,
+  };
+  return 1;
+}
+
+void mesh_file_close(mesh_file *file) {
+  if (file->mapping) {
+    mesh_file__unmap(file->mapping, file->mapping_size);
+  }
+  *file = (mesh_file){0};
+}
+
+int mesh_file_write(const char *path, const char *source, const char *text,
+                    const size_t length, const mesh_file *mesh) {
+  mesh_file__header header = {
+      .magic = MESH_FILE__MAGIC,
+      .version = MESH_FILE__VERSION,
+      .source_hash = mesh_file__hash(text, length),
+      .vertex_count = mesh->vertex_count,
+      .vertex_size = mesh->vertex_size,
+      .index_count = mesh->index_count,
+      .index_size = mesh->vertex_count <= 0xFFFF + 1 ? 2 : 4,
+      .bounds_center = {mesh->bounds_center[0], mesh->bounds_center[1],
+                        mesh->bounds_center[2]},
+      .bounds_radius = mesh->bounds_radius,
+  };
+  if (!mesh_file__stat(source, &header.source_size, &header.source_mtime)) {
+    return 0;
+  }
+
+  // written beside the target and renamed, so readers never see half a file
+  const size_t path_length = strlen(path);
+  char *temporary = malloc(path_length + 5);
+  memcpy(temporary, path, path_length);
+  memcpy(temporary + path_length, ".tmp", 5);
+
+  FILE *file = fopen(temporary, "wb");
+  if (file == NULL) {
+    free(temporary);
+    return 0;
+  }
+
+  int written =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(mesh->vertices, mesh->vertex_size, mesh->vertex_count, file) ==
+          mesh->vertex_count;
+
+  const uint32_t *indices = mesh->indices;
+  if (header.index_size == 2) {
+    uint16_t *short_indices =
+        malloc(sizeof(*short_indices) * mesh->index_count);
+    for (uint32_t i = 0; i < mesh->index_count; i++) {
+      short_indices[i] = (uint16_t)indices[i];
+    }
+    written = written && fwrite(short_indices, sizeof(*short_indices),
+                                mesh->index_count,
+                                file) == mesh->index_count;
+    free(short_indices);
+  } else {
+    written = written && fwrite(indices, sizeof(*indices), mesh->index_count,
+                                file) == mesh->index_count;
+  }
+
+  written = fclose(file) == 0 && written;
+  if (written) {
+    // rename replaces the target atomically on POSIX but fails on Windows
+    // when it exists, so never remove it first: a reader could find no file
+#ifdef _WIN32
+    written = MoveFileExA(temporary, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    written = rename(temporary, path) == 0;
+#endif
+  }
+  if (!written) {
+    remove(temporary);
+    debug_warn("Failed to write mesh file %s", path);
+  }
+
+  free(temporary);
+  return written;
+}
@@ -0,0 +1,52 @@
+/*--------------------------------------------------------------------------/
+  /                                                                           /
+  / mesh_file.h                                                               /
+  / A binary mesh format loaded by mapping it into memory                     /
+  /                                                                           /
+  /--------------------------------------------------------------------------*/
+
+#ifndef MESH_FILE_H
+#define MESH_FILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // ifdef __cplusplus
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A vertex stream, an index stream of 16 or 32 bit indices and a bounding
+// sphere. Opened files point vertices and indices into the mapping.
+typedef struct {
+  uint32_t vertex_count;
+  uint32_t vertex_size;
+  uint32_t index_count;
+  uint32_t index_size;
+  float bounds_center[3];
+  float bounds_radius;
+  const void *vertices;
+  const void *indices;
+
+  void *mapping;
+  size_t mapping_size;
+} mesh_file;
+
+// Maps the mesh file at path if it was written from source as it is now: the
+// same size and modification time, or the same content hash after a touch.
+// Returns 0 when the file is missing, stale, malformed, has an index past its
+// vertices or its vertices are not vertex_size bytes.
+int mesh_file_open(mesh_file *file, const char *path, const char *source,
+                   const uint32_t vertex_size);
+void mesh_file_close(mesh_file *file);
+
+// Writes mesh to path, stamped with source and the length bytes of its text.
+// Takes 32 bit indices and stores them in 16 bits when every index fits.
+// Returns 0 on failure.
+int mesh_file_write(const char *path, const char *source, const char *text,
+                    const size_t length, const mesh_file *mesh);
+
+#ifdef __cplusplus
+}
+#endif // ifdef __cplusplus
+
+#endif // MESH_FILE_H
@@ -0,0 +1,397 @@
+#include "mesh_optimize.h"
+#include "math3d.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MESH_OPTIMIZE__NONE (0xFFFFFFFFu)
+
+// the cache the Forsyth scores assume, larger than the simulated one so
+// vertices that just left a real cache still pull their triangles in
+#define MESH_OPTIMIZE__FORSYTH_CACHE (32)
+// remaining triangle counts with a precomputed valence score
+#define MESH_OPTIMIZE__FORSYTH_VALENCES (64)
+
+// A FIFO cache that remembers when each vertex went in. Everything entered
+// cache_size misses ago or earlier has been pushed out.
+typedef struct {
+  size_t *entered;
+  size_t time;
+  unsigned int cache_size;
+} mesh_optimize__fifo;
+
+static mesh_optimize__fifo
+mesh_optimize__fifo_alloc(const size_t vertex_count,
+                          const unsigned int cache_size) {
+  mesh_optimize__fifo fifo = {
+      .entered = calloc(vertex_count, sizeof(*fifo.entered)),
+      .time = cache_size + 1,
+      .cache_size = cache_size,
+  };
+  return fifo;
+}
+
+static void mesh_optimize__fifo_clear(mesh_optimize__fifo *fifo) {
+  fifo->time += fifo->cache_size + 1;
+}
+
+// misses of a triangle, which then sits in the cache
+static unsigned int mesh_optimize__fifo_triangle(mesh_optimize__fifo *fifo,
+                                                 const unsigned int *triangle) {
+  unsigned int misses = 0;
+  for (int k = 0; k < 3; k++) {
+    if (fifo->time - fifo->entered[triangle[k]] > fifo->cache_size) {
+      fifo->entered[triangle[k]] = ++fifo->time;
+      misses++;
+    }
+  }
+  return misses;
+}
+
+mesh_optimize_stats mesh_optimize_analyze(const unsigned int *indices,
+                                          const size_t index_count,
+                                          const size_t vertex_count,
+                                          const unsigned int cache_size) {
+  mesh_optimize_stats stats = {0, 0};
+  if (index_count < 3) {
+    return stats;
+  }
+
+  mesh_optimize__fifo fifo =
+      mesh_optimize__fifo_alloc(vertex_count, cache_size);
+  unsigned char *used = calloc(vertex_count, 1);
+  size_t misses = 0;
+  size_t used_count = 0;
+  for (size_t i = 0; i + 3 <= index_count; i += 3) {
+    misses += mesh_optimize__fifo_triangle(&fifo, indices + i);
+    for (int k = 0; k < 3; k++) {
+      used_count += !used[indices[i + k]];
+      used[indices[i + k]] = 1;
+    }
+  }
+  free(used);
+  free(fifo.entered);
+
+  stats.acmr = (float)misses / (float)(index_count / 3);
+  stats.atvr = (float)misses / (float)used_count;
+  return stats;
+}
+
+void mesh_optimize_vertex_cache(unsigned int *indices, const size_t index_count,
+                                const size_t vertex_count) {
+  const size_t triangle_count = index_count / 3;
+  if (triangle_count < 2) {
+    return;
+  }
+
+  // scores for a vertex at a cache position and with remaining triangles. the
+  // last triangle's vertices score the same, so no order is favoured there.
+  float cache_scores[MESH_OPTIMIZE__FORSYTH_CACHE];
+  for (int i = 0; i < MESH_OPTIMIZE__FORSYTH_CACHE; i++) {
+    cache_scores[i] =
+        i < 3 ? 0.75f
+              : powf(1.0f - (float)(i - 3) /
+                                (float)(MESH_OPTIMIZE__FORSYTH_CACHE - 3),
+                     1.5f);
+  }
+  float valence_scores[MESH_OPTIMIZE__FORSYTH_VALENCES];
+  for (int i = 1; i < MESH_OPTIMIZE__FORSYTH_VALENCES; i++) {
+    valence_scores[i] = 2.0f / sqrtf((float)i);
+  }
+
+  // the triangles around every vertex, live ones first
+  unsigned int *offsets = calloc(vertex_count + 1, sizeof(*offsets));
+  unsigned int *remaining = calloc(vertex_count, sizeof(*remaining));
+  for (size_t i = 0; i < triangle_count * 3; i++) {
+    remaining[indices[i]]++;
+  }
+  for (size_t v = 0; v < vertex_count; v++) {
+    offsets[v + 1] = offsets[v] + remaining[v];
+    remaining[v] = 0;
+  }
+  unsigned int *adjacency = malloc(sizeof(*adjacency) * triangle_count * 3);
+  for (size_t i = 0; i < triangle_count * 3; i++) {
+    const unsigned int v = indices[i];
+    adjacency[offsets[v] + remaining[v]++] = (unsigned int)(i / 3);
+  }
+
+  float *vertex_scores = malloc(sizeof(*vertex_scores) * vertex_count);
+  for (size_t v = 0; v < vertex_count; v++) {
+    vertex_scores[v] =
+        remaining[v] == 0 ? 0.0f
+        : remaining[v] < MESH_OPTIMIZE__FORSYTH_VALENCES
+            ? valence_scores[remaining[v]]
+            : 2.0f / sqrtf((float)remaining[v]);
+  }
+
+  // start from the triangle with the most isolated corners
+  unsigned char *emitted = calloc(triangle_count, 1);
+  unsigned int best = 0;
+  float best_score = -1.0f;
+  for (size_t t = 0; t < triangle_count; t++) {
+    const float score = vertex_scores[indices[t * 3]] +
+                        vertex_scores[indices[t * 3 + 1]] +
+                        vertex_scores[indices[t * 3 + 2]];
+    if (score > best_score) {
+      best_score = score;
+      best = (unsigned int)t;
+    }
+  }
+
+  unsigned int *output = malloc(sizeof(*output) * triangle_count * 3);
+  unsigned int cache[MESH_OPTIMIZE__FORSYTH_CACHE + 3];
+  unsigned int cache_count = 0;
+  size_t next_unemitted = 0;
+
+  for (size_t emit = 0; emit < triangle_count; emit++) {
+    if (best == MESH_OPTIMIZE__NONE) {
+      // nothing left around the cache, carry on in input order
+      while (emitted[next_unemitted]) {
+        next_unemitted++;
+      }
+      best = (unsigned int)next_unemitted;
+    }
+
+    const unsigned int *triangle = indices + (size_t)best * 3;
+    memcpy(output + emit * 3, triangle, sizeof(*output) * 3);
+    emitted[best] = 1;
+
+    // the triangle's corners move to the front, the rest slides back
+    unsigned int new_cache[MESH_OPTIMIZE__FORSYTH_CACHE + 3];
+    unsigned int new_count = 0;
+    for (int k = 0; k < 3; k++) {
+      const unsigned int v = triangle[k];
+      unsigned int *live = adjacency + offsets[v];
+      for (unsigned int a = 0; a < remaining[v]; a++) {
+        if (live[a] == best) {
+          live[a] = live[--remaining[v]];
+          break;
+        }
+      }
+      unsigned int seen = 0;
+      while (seen < new_count && new_cache[seen] != v) {
+        seen++;
+      }
+      if (seen == new_count) {
+        new_cache[new_count++] = v;
+      }
+    }
+    for (unsigned int i = 0; i < cache_count; i++) {
+      const unsigned int v = cache[i];
+      if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+        new_cache[new_count++] = v;
+      }
+    }
+
+    // vertices past the cache size were pushed out
+    for (unsigned int i = 0; i < new_count; i++) {
+      const unsigned int v = new_cache[i];
+      float score = 0.0f;
+      if (remaining[v] > 0) {
+        score = remaining[v] < MESH_OPTIMIZE__FORSYTH_VALENCES
+                    ? valence_scores[remaining[v]]
+                    : 2.0f / sqrtf((float)remaining[v]);
+        if (i < MESH_OPTIMIZE__FORSYTH_CACHE) {
+          score += cache_scores[i];
+        }
+      }
+      vertex_scores[v] = score;
+    }
+
+    best = MESH_OPTIMIZE__NONE;
+    best_score = -1.0f;
+    for (unsigned int i = 0; i < new_count; i++) {
+      const unsigned int v = new_cache[i];
+      const unsigned int *live = adjacency + offsets[v];
+      for (unsigned int a = 0; a < remaining[v]; a++) {
+        const unsigned int *t = indices + (size_t)live[a] * 3;
+        const float score =
+            vertex_scores[t[0]] + vertex_scores[t[1]] + vertex_scores[t[2]];
+        if (score > best_score) {
+          best_score = score;
+          best = live[a];
+        }
+      }
+    }
+
+    cache_count = new_count < MESH_OPTIMIZE__FORSYTH_CACHE
+                      ? new_count
+                      : MESH_OPTIMIZE__FORSYTH_CACHE;
+    memcpy(cache, new_cache, sizeof(*cache) * cache_count);
+  }
+
+  memcpy(indices, output, sizeof(*output) * triangle_count * 3);
+
+  free(output);
+  free(emitted);
+  free(vertex_scores);
+  free(adjacency);
+  free(remaining);
+  free(offsets);
+}
+
+static vector3 mesh_optimize__read(const float *base, const size_t stride,
+                                   const unsigned int vertex) {
+  float v[3];
+  memcpy(v, (const char *)base + stride * vertex, sizeof(v));
+  return (vector3){v[0], v[1], v[2]};
+}
+
+typedef struct {
+  size_t first; // triangle
+  size_t count;
+  float sort_key;
+} mesh_optimize__cluster;
+
+static int mesh_optimize__cluster_compare(const void *a, const void *b) {
+  const mesh_optimize__cluster *x = a;
+  const mesh_optimize__cluster *y = b;
+  if (x->sort_key != y->sort_key) {
+    return x->sort_key > y->sort_key ? -1 : 1;
+  }
+  // keep the cache order of equal clusters
+  return x->first < y->first ? -1 : x->first > y->first;
+}
+
+void mesh_optimize_overdraw(unsigned int *indices, const size_t index_count,
+                            const float *positions, const float *normals,
+                            const size_t stride, const size_t vertex_count,
+                            const float threshold) {
+  const size_t triangle_count = index_count / 3;
+  if (triangle_count < 2) {
+    return;
+  }
+
+  // the cache restarts where a triangle misses all its corners
+  mesh_optimize__fifo fifo =
+      mesh_optimize__fifo_alloc(vertex_count, MESH_OPTIMIZE_CACHE_SIZE);
+  unsigned char *misses = malloc(triangle_count);
+  for (size_t t = 0; t < triangle_count; t++) {
+    misses[t] = (unsigned char)mesh_optimize__fifo_triangle(&fifo,
+                                                            indices + t * 3);
+  }
+
+  // split every run again wherever its own miss rate, starting from an empty
+  // cache, has come down to the run's
+  mesh_optimize__cluster *clusters = malloc(sizeof(*clusters) * triangle_count);
+  size_t cluster_count = 0;
+  for (size_t start = 0; start < triangle_count;) {
+    size_t end = start + 1;
+    size_t run_misses = misses[start];
+    while (end < triangle_count && misses[end] < 3) {
+      run_misses += misses[end++];
+    }
+    const float limit =
+        threshold * (float)run_misses / (float)(end - start);
+
+    mesh_optimize__fifo_clear(&fifo);
+    size_t first = start;
+    size_t cluster_misses = 0;
+    for (size_t t = start; t < end; t++) {
+      cluster_misses += mesh_optimize__fifo_triangle(&fifo, indices + t * 3);
+      if ((float)cluster_misses <= limit * (float)(t + 1 - first) ||
+          t + 1 == end) {
+        clusters[cluster_count++] =
+            (mesh_optimize__cluster){.first = first, .count = t + 1 - first};
+        mesh_optimize__fifo_clear(&fifo);
+        first = t + 1;
+        cluster_misses = 0;
+      }
+    }
+    start = end;
+  }
+  free(misses);
+  free(fifo.entered);
+
+  // area weighted centres of the clusters and of the mesh
+  vector3 *centers = malloc(sizeof(*centers) * cluster_count);
+  vector3 *facings = malloc(sizeof(*facings) * cluster_count);
+  vector3 mesh_center = {0, 0, 0};
+  float mesh_area = 0.0f;
+  for (size_t c = 0; c < cluster_count; c++) {
+    vector3 center = {0, 0, 0};
+    vector3 facing = {0, 0, 0};
+    float area = 0.0f;
+    for (size_t t = clusters[c].first;
+         t < clusters[c].first + clusters[c].count; t++) {
+      const unsigned int *triangle = indices + t * 3;
+      const vector3 p0 = mesh_optimize__read(positions, stride, triangle[0]);
+      const vector3 p1 = mesh_optimize__read(positions, stride, triangle[1]);
+      const vector3 p2 = mesh_optimize__read(positions, stride, triangle[2]);
+      const float triangle_area = vector3_magnitude(
+          vector3_cross(vector3_sub(p1, p0), vector3_sub(p2, p0)));
+      const vector3 corners = vector3_add(vector3_add(p0, p1), p2);
+      center = vector3_add(center, vector3_scaled(corners, triangle_area));
+      area += triangle_area;
+      for (int k = 0; k < 3; k++) {
+        facing = vector3_add(
+            facing, mesh_optimize__read(normals, stride, triangle[k]));
+      }
+    }
+
+    // the sums hold three times the centroids
+    mesh_center = vector3_add(mesh_center, center);
+    mesh_area += area;
+    centers[c] =
+        area > 0.0f ? vector3_scaled(center, 1.0f / (3.0f * area)) : center;
+    facings[c] = facing;
+  }
+  if (mesh_area > 0.0f) {
+    mesh_center = vector3_scaled(mesh_center, 1.0f / (3.0f * mesh_area));
+  }
+
+  // clusters facing away from the centre are on the outside
+  for (size_t c = 0; c < cluster_count; c++) {
+    vector3_normalize(&facings[c]);
+    clusters[c].sort_key =
+        vector3_dot(vector3_sub(centers[c], mesh_center), facings[c]);
+  }
+  free(facings);
+  free(centers);
+
+  qsort(clusters, cluster_count, sizeof(*clusters),
+        mesh_optimize__cluster_compare);
+
+  unsigned int *output = malloc(sizeof(*output) * triangle_count * 3);
+  size_t written = 0;
+  for (size_t c = 0; c < cluster_count; c++) {
+    memcpy(output + written, indices + clusters[c].first * 3,
+           sizeof(*output) * clusters[c].count * 3);
+    written += clusters[c].count * 3;
+  }
+  memcpy(indices, output, sizeof(*output) * written);
+
+  free(output);
+  free(clusters);
+}
+
+size_t mesh_optimize_vertex_fetch(void *vertices, const size_t vertex_size,
+                                  unsigned int *indices,
+                                  const size_t index_count,
+                                  const size_t vertex_count) {
+  unsigned int *remap = malloc(sizeof(*remap) * vertex_count);
+  memset(remap, 0xFF, sizeof(*remap) * vertex_count);
+
+  unsigned int used = 0;
+  for (size_t i = 0; i < index_count; i++) {
+    if (remap[indices[i]] == MESH_OPTIMIZE__NONE) {
+      remap[indices[i]] = used++;
+    }
+    indices[i] = remap[indices[i]];
+  }
+
+  char *reordered = malloc(vertex_size * used);
+  for (size_t v = 0; v < vertex_count; v++) {
+    if (remap[v] != MESH_OPTIMIZE__NONE) {
+      memcpy(reordered + vertex_size * remap[v],
+             (const char *)vertices + vertex_size * v, vertex_size);
+    }
+  }
+  memcpy(vertices, reordered, vertex_size * used);
+
+  free(reordered);
+  free(remap);
+  return used;
+}
@@ -0,0 +1,63 @@
+/*--------------------------------------------------------------------------/
+  /                                                                           /
+  / mesh_optimize.h                                                           /
+  / Index and vertex reordering for faster indexed triangle drawing           /
+  /                                                                           /
+  /--------------------------------------------------------------------------*/
+
+#ifndef MESH_OPTIMIZE_H
+#define MESH_OPTIMIZE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // ifdef __cplusplus
+
+#include <stddef.h>
+
+// entries of the FIFO cache the statistics simulate, about what current GPUs
+// reuse between neighbouring triangles.
+#define MESH_OPTIMIZE_CACHE_SIZE (16)
+
+typedef struct {
+  // average cache misses per triangle, 0.5 at best and 3 at worst
+  float acmr;
+  // average cache misses per referenced vertex, 1 at best
+  float atvr;
+} mesh_optimize_stats;
+
+// Simulates a FIFO post transform cache of cache_size entries over an index
+// list of triangles into vertex_count vertices.
+mesh_optimize_stats mesh_optimize_analyze(const unsigned int *indices,
+                                          size_t index_count,
+                                          size_t vertex_count,
+                                          unsigned int cache_size);
+
+// Reorders the triangles of indices so neighbouring triangles share vertices,
+// following Tom Forsyth's linear speed vertex cache optimisation. The corners
+// of every triangle keep their order, so does the winding.
+void mesh_optimize_vertex_cache(unsigned int *indices, size_t index_count,
+                                size_t vertex_count);
+
+// Reorders the triangles of a cache optimised index list so clusters on the
+// outside of the mesh are drawn before the ones they hide, after Sander et
+// al. Clusters end where the simulated cache restarts and where their miss
+// rate is within threshold times the rate of the whole run, 1.05 keeps nearly
+// all of the cache optimisation. Facing comes from the vertex normals, not the
+// winding. positions and normals are 3 floats at every stride bytes.
+void mesh_optimize_overdraw(unsigned int *indices, size_t index_count,
+                            const float *positions, const float *normals,
+                            size_t stride, size_t vertex_count,
+                            float threshold);
+
+// Reorders the vertex_count vertices of vertex_size bytes in the order indices
+// first use them and rewrites indices to match. Unused vertices are dropped.
+// Returns the number of vertices left.
+size_t mesh_optimize_vertex_fetch(void *vertices, size_t vertex_size,
+                                  unsigned int *indices, size_t index_count,
+                                  size_t vertex_count);
+
+#ifdef __cplusplus
+}
+#endif // ifdef __cplusplus
+
+#endif // MESH_OPTIMIZE_H
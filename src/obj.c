@@ -0,0 +1,632 @@
+#include "obj.h"
+#include "jobs.h"
+#include "log.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// powers of ten a double represents exactly
+static const double obj__powers[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static int obj__is_space(const char c) { return c == ' ' || c == '\t'; }
+static int obj__is_digit(const char c) { return c >= '0' && c <= '9'; }
+
+static const char *obj__skip_space(const char *c, const char *end) {
+  while (c < end && obj__is_space(*c)) {
+    c++;
+  }
+  return c;
+}
+
+// Parses a decimal number like -12.5e-3 at *cursor and moves past it. Keeps
+// the first 19 significant digits, which is far beyond float precision.
+// Returns 0 when there is no number.
+static int obj__parse_float(const char **cursor, const char *end,
+                            float *value) {
+  const char *c = *cursor;
+
+  int negative = 0;
+  if (c < end && (*c == '-' || *c == '+')) {
+    negative = *c == '-';
+    c++;
+  }
+
+  uint64_t mantissa = 0;
+  int significant = 0;
+  int exponent = 0;
+  int digits = 0;
+
+  for (; c < end && obj__is_digit(*c); c++, digits++) {
+    if (significant < 19) {
+      mantissa = mantissa * 10 + (uint64_t)(*c - '0');
+      significant += mantissa != 0;
+    } else {
+      exponent++;
+    }
+  }
+
+  if (c < end && *c == '.') {
+    for (c++; c < end && obj__is_digit(*c); c++, digits++) {
+      if (significant < 19) {
+        mantissa = mantissa * 10 + (uint64_t)(*c - '0');
+        significant += mantissa != 0;
+        exponent--;
+      }
+    }
+  }
+
+  if (digits == 0) {
+    return 0;
+  }
+
+  if (c < end && (*c == 'e' || *c == 'E')) {
+    const char *e = c + 1;
+    int exponent_negative = 0;
+    if (e < end && (*e == '-' || *e == '+')) {
+      exponent_negative = *e == '-';
+      e++;
+    }
+    if (e < end && obj__is_digit(*e)) {
+      int written = 0;
+      for (; e < end && obj__is_digit(*e); e++) {
+        if (written < 10000) {
+          written = written * 10 + (*e - '0');
+        }
+      }
+      exponent += exponent_negative ? -written : written;
+      c = e;
+    }
+  }
+
+  double result = (double)mantissa;
+  if (mantissa != 0) {
+    if (exponent < 0 && exponent >= -22) {
+      result /= obj__powers[-exponent];
+    } else if (exponent > 0 && exponent <= 22) {
+      result *= obj__powers[exponent];
+    } else if (exponent != 0) {
+      result *= pow(10.0, exponent);
+    }
+  }
+
+  *value = (float)(negative ? -result : result);
+  *cursor = c;
+  return 1;
+}
+
+static int obj__parse_int(const char **cursor, const char *end, long *value) {
+  const char *c = *cursor;
+
+  int negative = 0;
+  if (c < end && (*c == '-' || *c == '+')) {
+    negative = *c == '-';
+    c++;
+  }
+
+  if (c == end || !obj__is_digit(*c)) {
+    return 0;
+  }
+
+  long result = 0;
+  for (; c < end && obj__is_digit(*c); c++) {
+    if (result < 1000000000L) {
+      result = result * 10 + (*c - '0');
+    }
+  }
+
+  *value = negative ? -result : result;
+  *cursor = c;
+  return 1;
+}
+
+// reads up to count floats of a v, vt or vn statement. missing ones stay 0.
+static void obj__parse_floats(const char *c, const char *end, float *values,
+                              const int count) {
+  for (int i = 0; i < count; i++) {
+    c = obj__skip_space(c, end);
+    if (!obj__parse_float(&c, end, &values[i])) {
+      return;
+    }
+  }
+}
+
+// zero based index of a one based or negative OBJ index into a list of count
+// attributes, OBJ_NONE when it is out of range.
+static unsigned int obj__resolve(const long index, const sc_list_size count) {
+  if (index > 0 && (sc_list_size)index <= count) {
+    return (unsigned int)(index - 1);
+  }
+  if (index < 0 && (sc_list_size)-index <= count) {
+    return (unsigned int)(count + index);
+  }
+  return OBJ_NONE;
+}
+
+// attributes read so far, which relative and range checked indices refer to
+typedef struct {
+  sc_list_size positions;
+  sc_list_size texcoords;
+  sc_list_size normals;
+} obj__counts;
+
+// parses the corners of an f statement into polygon. returns 0 if a corner is
+// malformed or references a missing attribute.
+static int obj__parse_face(const obj__counts counts, const char *c,
+                           const char *end, sc_list_obj_corner *polygon) {
+  sc_list_obj_corner_clear(*polygon);
+
+  for (c = obj__skip_space(c, end); c < end; c = obj__skip_space(c, end)) {
+    obj_corner corner = {OBJ_NONE, OBJ_NONE, OBJ_NONE};
+    long index;
+
+    if (!obj__parse_int(&c, end, &index)) {
+      return 0;
+    }
+    corner.position = obj__resolve(index, counts.positions);
+    if (corner.position == OBJ_NONE) {
+      return 0;
+    }
+
+    if (c < end && *c == '/') {
+      c++;
+      if (c < end && *c != '/') { // v/t or v/t/n
+        if (!obj__parse_int(&c, end, &index)) {
+          return 0;
+        }
+        corner.texcoord = obj__resolve(index, counts.texcoords);
+        if (corner.texcoord == OBJ_NONE) {
+          return 0;
+        }
+      }
+
+      if (c < end && *c == '/') { // v//n or v/t/n
+        c++;
+        if (!obj__parse_int(&c, end, &index)) {
+          return 0;
+        }
+        corner.normal = obj__resolve(index, counts.normals);
+        if (corner.normal == OBJ_NONE) {
+          return 0;
+        }
+      }
+    }
+
+    if (c < end && !obj__is_space(*c)) {
+      return 0;
+    }
+
+    sc_list_obj_corner_add(polygon, corner);
+  }
+
+  return sc_list_obj_corner_count(*polygon) >= 3;
+}
+
+typedef enum {
+  OBJ__STATEMENT_OTHER,
+  OBJ__STATEMENT_POSITION,
+  OBJ__STATEMENT_TEXCOORD,
+  OBJ__STATEMENT_NORMAL,
+  OBJ__STATEMENT_FACE,
+} obj__statement;
+
+// finds the line at *cursor and moves past it. *arguments is set to what
+// follows the statement keyword and *line_end to the end without the newline.
+static obj__statement obj__next_line(const char **cursor, const char *end,
+                                     const char **arguments,
+                                     const char **line_end) {
+  const char *c = *cursor;
+  const char *e = memchr(c, '\n', end - c);
+  if (e == NULL) {
+    e = end;
+  }
+  *cursor = e < end ? e + 1 : end;
+  if (e > c && e[-1] == '\r') {
+    e--;
+  }
+  *line_end = e;
+
+  c = obj__skip_space(c, e);
+  if (e - c >= 2 && obj__is_space(c[1])) {
+    *arguments = c + 2;
+    return c[0] == 'v'   ? OBJ__STATEMENT_POSITION
+           : c[0] == 'f' ? OBJ__STATEMENT_FACE
+                         : OBJ__STATEMENT_OTHER;
+  }
+  if (e - c >= 3 && c[0] == 'v' && obj__is_space(c[2])) {
+    *arguments = c + 3;
+    return c[1] == 't'   ? OBJ__STATEMENT_TEXCOORD
+           : c[1] == 'n' ? OBJ__STATEMENT_NORMAL
+                         : OBJ__STATEMENT_OTHER;
+  }
+  return OBJ__STATEMENT_OTHER;
+}
+
+// chunks smaller than this are not worth handing to another thread
+#define OBJ__CHUNK_SIZE (1 << 20)
+
+// A run of whole lines parsed on its own. Counting first gives every chunk
+// the attribute counts before it, so its attributes go straight to their
+// final place and its faces resolve to final indices, relative ones included.
+typedef struct {
+  const char *begin;
+  const char *end;
+  size_t line; // of begin
+  size_t lines;
+  obj__counts first; // attributes before the chunk
+  obj__counts own;
+  sc_list_obj_corner corners;
+  size_t skipped_faces;
+  size_t first_skipped_line;
+} obj__chunk;
+
+typedef struct {
+  obj__chunk *chunks;
+  obj_mesh *mesh;
+} obj__parse_job;
+
+static void obj__count_job(void *user, size_t begin, size_t end) {
+  const obj__parse_job *job = user;
+  for (size_t i = begin; i < end; i++) {
+    obj__chunk *chunk = &job->chunks[i];
+    const char *arguments;
+    const char *line_end;
+    for (const char *c = chunk->begin; c < chunk->end; chunk->lines++) {
+      switch (obj__next_line(&c, chunk->end, &arguments, &line_end)) {
+      case OBJ__STATEMENT_POSITION:
+        chunk->own.positions++;
+        break;
+      case OBJ__STATEMENT_TEXCOORD:
+        chunk->own.texcoords++;
+        break;
+      case OBJ__STATEMENT_NORMAL:
+        chunk->own.normals++;
+        break;
+      default:
+        break;
+      }
+    }
+  }
+}
+
+static void obj__parse_chunk(obj__chunk *chunk, obj_mesh *mesh) {
+  obj__counts counts = chunk->first;
+  sc_list_obj_corner polygon = sc_list_obj_corner_alloc();
+  chunk->corners = sc_list_obj_corner_alloc();
+
+  const char *arguments;
+  const char *end;
+  size_t line = chunk->line;
+  for (const char *c = chunk->begin; c < chunk->end; line++) {
+    switch (obj__next_line(&c, chunk->end, &arguments, &end)) {
+    case OBJ__STATEMENT_POSITION: {
+      float v[3] = {0, 0, 0};
+      obj__parse_floats(arguments, end, v, 3);
+      mesh->positions[counts.positions++] = (vector3){v[0], v[1], v[2]};
+      break;
+    }
+    case OBJ__STATEMENT_TEXCOORD: {
+      float t[2] = {0, 0};
+      obj__parse_floats(arguments, end, t, 2);
+      mesh->texcoords[counts.texcoords++] = (vector2){t[0], t[1]};
+      break;
+    }
+    case OBJ__STATEMENT_NORMAL: {
+      float n[3] = {0, 0, 0};
+      obj__parse_floats(arguments, end, n, 3);
+      mesh->normals[counts.normals++] = (vector3){n[0], n[1], n[2]};
+      break;
+    }
+    case OBJ__STATEMENT_FACE:
+      if (obj__parse_face(counts, arguments, end, &polygon)) {
+        for (sc_list_size i = 2; i < sc_list_obj_corner_count(polygon); i++) {
+          sc_list_obj_corner_add(&chunk->corners, polygon[0]);
+          sc_list_obj_corner_add(&chunk->corners, polygon[i - 1]);
+          sc_list_obj_corner_add(&chunk->corners, polygon[i]);
+        }
+      } else if (chunk->skipped_faces++ == 0) {
+        chunk->first_skipped_line = line;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  sc_list_obj_corner_free(polygon);
+}
+
+static void obj__parse_job_range(void *user, size_t begin, size_t end) {
+  const obj__parse_job *job = user;
+  for (size_t i = begin; i < end; i++) {
+    obj__parse_chunk(&job->chunks[i], job->mesh);
+  }
+}
+
+// parses the whole text in one pass, appending to mesh as it goes. used when
+// there is nothing to split the work with, where the counting pass of the
+// chunks would only cost time.
+static void obj__parse_lines(const char *text, const char *end, obj_mesh *mesh,
+                             size_t *skipped_faces,
+                             size_t *first_skipped_line) {
+  sc_list_obj_corner polygon = sc_list_obj_corner_alloc();
+
+  const char *arguments;
+  const char *line_end;
+  size_t line = 1;
+  for (const char *c = text; c < end; line++) {
+    switch (obj__next_line(&c, end, &arguments, &line_end)) {
+    case OBJ__STATEMENT_POSITION: {
+      float v[3] = {0, 0, 0};
+      obj__parse_floats(arguments, line_end, v, 3);
+      sc_list_vector3_add(&mesh->positions, (vector3){v[0], v[1], v[2]});
+      break;
+    }
+    case OBJ__STATEMENT_TEXCOORD: {
+      float t[2] = {0, 0};
+      obj__parse_floats(arguments, line_end, t, 2);
+      sc_list_vector2_add(&mesh->texcoords, (vector2){t[0], t[1]});
+      break;
+    }
+    case OBJ__STATEMENT_NORMAL: {
+      float n[3] = {0, 0, 0};
+      obj__parse_floats(arguments, line_end, n, 3);
+      sc_list_vector3_add(&mesh->normals, (vector3){n[0], n[1], n[2]});
+      break;
+    }
+    case OBJ__STATEMENT_FACE: {
+      const obj__counts counts = {
+          sc_list_vector3_count(mesh->positions),
+          sc_list_vector2_count(mesh->texcoords),
+          sc_list_vector3_count(mesh->normals),
+      };
+      if (obj__parse_face(counts, arguments, line_end, &polygon)) {
+        for (sc_list_size i = 2; i < sc_list_obj_corner_count(polygon); i++) {
+          sc_list_obj_corner_add(&mesh->corners, polygon[0]);
+          sc_list_obj_corner_add(&mesh->corners, polygon[i - 1]);
+          sc_list_obj_corner_add(&mesh->corners, polygon[i]);
+        }
+      } else if ((*skipped_faces)++ == 0) {
+        *first_skipped_line = line;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  sc_list_obj_corner_free(polygon);
+}
+
+// splits text into chunk_count runs of whole lines and parses them across the
+// job system, counting the attributes of every chunk first.
+static void obj__parse_chunks(const char *text, const size_t length,
+                              const size_t chunk_count, obj_mesh *mesh,
+                              size_t *skipped_faces,
+                              size_t *first_skipped_line) {
+  // split at the line ends after even offsets
+  obj__chunk *chunks = calloc(chunk_count, sizeof(*chunks));
+  const char *end = text + length;
+  const char *c = text;
+  for (size_t i = 0; i < chunk_count; i++) {
+    const char *split = text + length / chunk_count * (i + 1);
+    if (i + 1 == chunk_count || split <= c) {
+      split = i + 1 == chunk_count ? end : c;
+    } else {
+      const char *newline = memchr(split - 1, '\n', end - (split - 1));
+      split = newline ? newline + 1 : end;
+    }
+    chunks[i].begin = c;
+    chunks[i].end = split;
+    c = split;
+  }
+
+  obj__parse_job job = {.chunks = chunks, .mesh = mesh};
+  jobs_parallel_for(chunk_count, 1, obj__count_job, &job);
+
+  obj__counts total = {0, 0, 0};
+  size_t line = 1;
+  for (size_t i = 0; i < chunk_count; i++) {
+    chunks[i].first = total;
+    chunks[i].line = line;
+    total.positions += chunks[i].own.positions;
+    total.texcoords += chunks[i].own.texcoords;
+    total.normals += chunks[i].own.normals;
+    line += chunks[i].lines;
+  }
+  sc_list_vector3_resize(&mesh->positions, total.positions);
+  sc_list_vector2_resize(&mesh->texcoords, total.texcoords);
+  sc_list_vector3_resize(&mesh->normals, total.normals);
+
+  jobs_parallel_for(chunk_count, 1, obj__parse_job_range, &job);
+
+  sc_list_size corner_count = 0;
+  for (size_t i = 0; i < chunk_count; i++) {
+    corner_count += sc_list_obj_corner_count(chunks[i].corners);
+    if (chunks[i].skipped_faces && *skipped_faces == 0) {
+      *first_skipped_line = chunks[i].first_skipped_line;
+    }
+    *skipped_faces += chunks[i].skipped_faces;
+  }
+
+  sc_list_obj_corner_resize(&mesh->corners, corner_count);
+  corner_count = 0;
+  for (size_t i = 0; i < chunk_count; i++) {
+    const sc_list_size count = sc_list_obj_corner_count(chunks[i].corners);
+    memcpy(mesh->corners + corner_count, chunks[i].corners,
+           sizeof(*mesh->corners) * count);
+    corner_count += count;
+    sc_list_obj_corner_free(chunks[i].corners);
+  }
+  free(chunks);
+}
+
+obj_mesh obj_parse(const char *text, const size_t length) {
+  obj_mesh mesh = {
+      .positions = sc_list_vector3_alloc(),
+      .texcoords = sc_list_vector2_alloc(),
+      .normals = sc_list_vector3_alloc(),
+      .corners = sc_list_obj_corner_alloc(),
+  };
+
+  // a few chunks per thread so faster threads pick up the slack
+  size_t chunk_count = (size_t)(jobs_thread_count() + 1) * 4;
+  if (chunk_count > length / OBJ__CHUNK_SIZE) {
+    chunk_count = length / OBJ__CHUNK_SIZE;
+  }
+
+  size_t skipped_faces = 0;
+  size_t first_skipped_line = 0;
+  if (chunk_count <= 1 || jobs_thread_count() == 0) {
+    obj__parse_lines(text, text + length, &mesh, &skipped_faces,
+                     &first_skipped_line);
+  } else {
+    obj__parse_chunks(text, length, chunk_count, &mesh, &skipped_faces,
+                      &first_skipped_line);
+  }
+
+  if (skipped_faces) {
+    debug_warn("Skipped %zu malformed OBJ faces, the first on line %zu",
+               skipped_faces, first_skipped_line);
+  }
+
+  return mesh;
+}
+
+void obj_free(obj_mesh *mesh) {
+  sc_list_vector3_free(mesh->positions);
+  sc_list_vector2_free(mesh->texcoords);
+  sc_list_vector3_free(mesh->normals);
+  sc_list_obj_corner_free(mesh->corners);
+  *mesh = (obj_mesh){0};
+}
+
+void obj_smooth_normals(obj_mesh *mesh) {
+  const sc_list_size corner_count = sc_list_obj_corner_count(mesh->corners);
+  const sc_list_size position_count = sc_list_vector3_count(mesh->positions);
+
+  int missing = 0;
+  for (sc_list_size i = 0; i < corner_count && !missing; i++) {
+    missing = mesh->corners[i].normal == OBJ_NONE;
+  }
+  if (!missing) {
+    return;
+  }
+
+  // the cross product is twice the triangle area, which does the weighting
+  vector3 *sums = calloc(position_count, sizeof(*sums));
+  for (sc_list_size i = 0; i < corner_count; i += 3) {
+    const obj_corner *triangle = mesh->corners + i;
+    const vector3 a = mesh->positions[triangle[0].position];
+    const vector3 b = mesh->positions[triangle[1].position];
+    const vector3 c = mesh->positions[triangle[2].position];
+    const vector3 normal =
+        vector3_cross(vector3_sub(b, a), vector3_sub(c, a));
+    for (int k = 0; k < 3; k++) {
+      vector3 *sum = &sums[triangle[k].position];
+      *sum = vector3_add(*sum, normal);
+    }
+  }
+
+  // one generated normal per position that needs one
+  unsigned int *generated = malloc(sizeof(*generated) * position_count);
+  memset(generated, 0xFF, sizeof(*generated) * position_count);
+  for (sc_list_size i = 0; i < corner_count; i++) {
+    obj_corner *corner = &mesh->corners[i];
+    if (corner->normal != OBJ_NONE) {
+      continue;
+    }
+
+    if (generated[corner->position] == OBJ_NONE) {
+      vector3 normal = sums[corner->position];
+      vector3_normalize(&normal);
+      generated[corner->position] = sc_list_vector3_count(mesh->normals);
+      sc_list_vector3_add(&mesh->normals, normal);
+    }
+    corner->normal = generated[corner->position];
+  }
+
+  free(generated);
+  free(sums);
+}
+
+static uint64_t obj__corner_hash(const obj_corner corner) {
+  uint64_t h = corner.position * 0x9E3779B97F4A7C15ull;
+  h ^= (h >> 29) ^ corner.texcoord * 0xBF58476D1CE4E5B9ull;
+  h ^= (h >> 32) ^ corner.normal * 0x94D049BB133111EBull;
+  return h ^ (h >> 31);
+}
+
+// open addressing table from a corner to its vertex in a list of vertices
+typedef struct {
+  unsigned int *slots;
+  size_t mask;
+} obj__weld_table;
+
+static obj__weld_table obj__weld_table_alloc(const size_t count) {
+  size_t capacity = 64;
+  while (capacity < count * 2) { // keep the load under half
+    capacity *= 2;
+  }
+
+  obj__weld_table table = {
+      .slots = malloc(sizeof(*table.slots) * capacity),
+      .mask = capacity - 1,
+  };
+  memset(table.slots, 0xFF, sizeof(*table.slots) * capacity);
+  return table;
+}
+
+// slot holding corner, or the empty slot where it belongs
+static size_t obj__weld_find(const obj__weld_table *table,
+                             const sc_list_obj_corner vertices,
+                             const obj_corner corner) {
+  size_t slot = (size_t)obj__corner_hash(corner) & table->mask;
+  for (;;) {
+    const unsigned int vertex = table->slots[slot];
+    if (vertex == OBJ_NONE || (vertices[vertex].position == corner.position &&
+                               vertices[vertex].texcoord == corner.texcoord &&
+                               vertices[vertex].normal == corner.normal)) {
+      return slot;
+    }
+    slot = (slot + 1) & table->mask;
+  }
+}
+
+sc_list_obj_corner obj_weld(const obj_mesh *mesh, unsigned int *indices) {
+  const sc_list_size corner_count = sc_list_obj_corner_count(mesh->corners);
+  sc_list_obj_corner vertices = sc_list_obj_corner_alloc();
+
+  // most meshes have about one vertex per position, grow if not
+  obj__weld_table table =
+      obj__weld_table_alloc(sc_list_vector3_count(mesh->positions));
+
+  for (sc_list_size i = 0; i < corner_count; i++) {
+    const obj_corner corner = mesh->corners[i];
+    const size_t slot = obj__weld_find(&table, vertices, corner);
+    if (table.slots[slot] != OBJ_NONE) {
+      indices[i] = table.slots[slot];
+      continue;
+    }
+
+    const unsigned int vertex = sc_list_obj_corner_count(vertices);
+    table.slots[slot] = vertex;
+    indices[i] = vertex;
+    sc_list_obj_corner_add(&vertices, corner);
+
+    if ((vertex + 1) * 2 > table.mask + 1) {
+      free(table.slots);
+      table = obj__weld_table_alloc((vertex + 1) * 2);
+      for (unsigned int v = 0; v <= vertex; v++) {
+        table.slots[obj__weld_find(&table, vertices, vertices[v])] = v;
+      }
+    }
+  }
+
+  free(table.slots);
+  return vertices;
+}
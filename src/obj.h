@@ -0,0 +1,62 @@
+/*--------------------------------------------------------------------------/
+  /                                                                           /
+  / obj.h                                                                     /
+  / A Wavefront OBJ geometry parser                                           /
+  /                                                                           /
+  /--------------------------------------------------------------------------*/
+
+#ifndef OBJ_H
+#define OBJ_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // ifdef __cplusplus
+
+#include "collections.h"
+#include "math3d.h"
+
+SC_LIST(vector3)
+SC_LIST(vector2)
+
+#define OBJ_NONE (0xFFFFFFFFu)
+
+// One corner of a face as zero based indices into the obj_mesh attribute
+// lists, OBJ_NONE for attributes the face does not reference.
+typedef struct {
+  unsigned int position;
+  unsigned int texcoord;
+  unsigned int normal;
+} obj_corner;
+
+SC_LIST(obj_corner)
+
+typedef struct {
+  sc_list_vector3 positions;
+  sc_list_vector2 texcoords;
+  sc_list_vector3 normals;
+  // three per triangle. polygons are split into a fan around their first
+  // corner.
+  sc_list_obj_corner corners;
+} obj_mesh;
+
+// Parses the v, vt, vn and f statements of length bytes of OBJ text, in every
+// face form: v, v/t, v//n and v/t/n, with negative indices counting back from
+// the last attribute read. Other statements are skipped. Faces referencing
+// missing attributes are dropped with a warning.
+obj_mesh obj_parse(const char *text, size_t length);
+void obj_free(obj_mesh *mesh);
+
+// Gives every corner without a normal the area weighted average of the normals
+// of the triangles around its position, appended to mesh->normals.
+void obj_smooth_normals(obj_mesh *mesh);
+
+// Welds corners with the same position, texcoord and normal into one vertex.
+// Writes the vertex of every corner to indices and returns one corner per
+// vertex, in order of first use.
+sc_list_obj_corner obj_weld(const obj_mesh *mesh, unsigned int *indices);
+
+#ifdef __cplusplus
+}
+#endif // ifdef __cplusplus
+
+#endif // OBJ_H
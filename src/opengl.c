@@ -1,13 +1,151 @@
 #include "opengl.h"
 #include "file.h"
+#include "jobs.h"
+#include "mesh_file.h"
+#include "mesh_optimize.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include <assert.h>
+#include <float.h>
+#include <stdatomic.h>
+#include <string.h>
+
+// per-instance dirty bits. the matrix bit means the cached CPU matrix is stale,
+// the region bits mean that region of the instance stream is stale.
+#define RENDERER_GL__DIRTY_MATRIX (1 << 0)
+#define RENDERER_GL__DIRTY_REGION(region) (1 << (1 + (region)))
+#define RENDERER_GL__DIRTY_ALL                                                 \
+  ((1 << (1 + RENDERER_GL_INSTANCE_STREAM_REGIONS)) - 1)
+
+#define RENDERER_GL__CAMERA_FAR (1000)
+#define RENDERER_GL__CAMERA_FOV (70 * (3.14159 / 180.0))
+
+// instances per job when building matrices on the job system.
+#define RENDERER_GL__MATRIX_JOB_GRAIN (2048)
 
 static renderer_gl_framebuffer *renderer_gl__active_framebuffer = NULL;
 static renderer_gl_framebuffer *renderer_gl__active_framebuffer_MSAA = NULL;
 static renderer_gl_context *renderer_gl__active_context = NULL;
 
+// texture units the renderer binds material maps to.
+#define RENDERER_GL__TEXTURE_UNITS (2)
+
+// shadow copy of the GL state the draw path changes. ~0 / 0 mean unknown.
+static struct {
+  GLuint program;
+  GLenum polygon_mode;
+  GLuint stencil_mask;
+  int stencil_mask_known;
+  GLenum active_texture;
+  GLuint textures[RENDERER_GL__TEXTURE_UNITS];
+  GLuint vertex_array;
+} renderer_gl__state;
+
+static void renderer_gl__state_count(const int issued) {
+  if (renderer_gl__active_context == NULL) {
+    return;
+  }
+  if (issued) {
+    renderer_gl__active_context->state_changes++;
+  } else {
+    renderer_gl__active_context->state_changes_skipped++;
+  }
+}
+
+void renderer_gl_state_invalidate(void) {
+  renderer_gl__state.program = ~0u;
+  renderer_gl__state.polygon_mode = 0;
+  renderer_gl__state.stencil_mask_known = 0;
+  renderer_gl__state.active_texture = 0;
+  for (unsigned int i = 0; i < RENDERER_GL__TEXTURE_UNITS; i++) {
+    renderer_gl__state.textures[i] = ~0u;
+  }
+  renderer_gl__state.vertex_array = ~0u;
+}
+
+static void renderer_gl__use_program(const GLuint program) {
+  const int issued = renderer_gl__state.program != program;
+  if (issued) {
+    glUseProgram(program);
+    renderer_gl__state.program = program;
+  }
+  renderer_gl__state_count(issued);
+}
+
+static void renderer_gl__polygon_mode(const GLenum mode) {
+  const int issued = renderer_gl__state.polygon_mode != mode;
+  if (issued) {
+    glPolygonMode(GL_FRONT_AND_BACK, mode);
+    renderer_gl__state.polygon_mode = mode;
+  }
+  renderer_gl__state_count(issued);
+}
+
+static void renderer_gl__stencil_mask(const GLuint mask) {
+  const int issued = !renderer_gl__state.stencil_mask_known ||
+                     renderer_gl__state.stencil_mask != mask;
+  if (issued) {
+    glStencilMask(mask);
+    renderer_gl__state.stencil_mask = mask;
+    renderer_gl__state.stencil_mask_known = 1;
+  }
+  renderer_gl__state_count(issued);
+}
+
+// binds a GL_TEXTURE_2D to unit, switching the active unit only if needed.
+static void renderer_gl__bind_texture(const GLuint unit, const GLuint texture) {
+  assert(unit < RENDERER_GL__TEXTURE_UNITS);
+  const int issued = renderer_gl__state.textures[unit] != texture;
+  if (issued) {
+    if (renderer_gl__state.active_texture != GL_TEXTURE0 + unit) {
+      glActiveTexture(GL_TEXTURE0 + unit);
+      renderer_gl__state.active_texture = GL_TEXTURE0 + unit;
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    renderer_gl__state.textures[unit] = texture;
+  }
+  renderer_gl__state_count(issued);
+}
+
+static void renderer_gl__bind_vertex_array(const GLuint vertex_array) {
+  const int issued = renderer_gl__state.vertex_array != vertex_array;
+  if (issued) {
+    glBindVertexArray(vertex_array);
+    renderer_gl__state.vertex_array = vertex_array;
+  }
+  renderer_gl__state_count(issued);
+}
+
+// deletes *vertex_array and zeroes it. GL falls back to vertex array 0 when the
+// bound one is deleted, and the next glGenVertexArrays may return the same
+// name, so the shadow must not keep claiming it is bound.
+static void renderer_gl__delete_vertex_array(GLuint *vertex_array) {
+  if (*vertex_array && renderer_gl__state.vertex_array == *vertex_array) {
+    renderer_gl__state.vertex_array = 0;
+  }
+  glDeleteVertexArrays(1, vertex_array);
+  *vertex_array = 0;
+}
+
+// deletes *texture and zeroes it, clearing every unit the shadow has it bound
+// to for the same reason.
+static void renderer_gl__delete_texture(GLuint *texture) {
+  for (unsigned int i = 0; i < RENDERER_GL__TEXTURE_UNITS; i++) {
+    if (*texture && renderer_gl__state.textures[i] == *texture) {
+      renderer_gl__state.textures[i] = 0;
+    }
+  }
+  glDeleteTextures(1, texture);
+  *texture = 0;
+}
+
+// deletes *buffer and zeroes it. buffer bindings are not shadowed, this only
+// keeps every delete going through the same kind of helper.
+static void renderer_gl__delete_buffer(GLuint *buffer) {
+  glDeleteBuffers(1, buffer);
+  *buffer = 0;
+}
+
 void renderer_gl_active_framebuffer_set(renderer_gl_framebuffer *frame) {
   renderer_gl__active_framebuffer = frame;
 }
@@ -35,7 +173,7 @@ GLuint renderer_gl_texture_alloc(const char *imageFile) {
   /*create texture*/
   GLuint texture;
   glGenTextures(1, &texture);
-  glBindTexture(GL_TEXTURE_2D, texture);
+  renderer_gl__bind_texture(0, texture);
 
   /*set parameters*/
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -66,25 +204,188 @@ GLuint renderer_gl_texture_alloc(const char *imageFile) {
 
   /*cleanup*/
   stbi_image_free(data);
-  glBindTexture(GL_TEXTURE_2D, 0);
+  renderer_gl__bind_texture(0, 0);
   return texture;
 }
 
-GLuint renderer_gl_shader_compile(const char *file_path, GLenum type) {
-  debug_log("compiling shader from '%s'", file_path);
-  file_buffer fb = file_buffer_alloc(file_path);
-  if (fb.error) { // error check
-    debug_error("failed to read shader from '%s'\n", file_path);
+enum {
+  RENDERER_GL__TEXTURE_DECODING,
+  RENDERER_GL__TEXTURE_DECODED,
+  RENDERER_GL__TEXTURE_FAILED,
+};
+
+// one texture of renderer_gl_texture_alloc_async. the worker fills in the
+// image before it publishes the new state, the GL thread only reads it after.
+// cancelled is set by renderer_gl_texture_free, the load is then dropped
+// instead of uploaded into a texture that may already have a new owner.
+typedef struct {
+  char *path;
+  GLuint texture;
+  unsigned char *pixels;
+  int width;
+  int height;
+  int channels;
+  atomic_int state;
+  atomic_int cancelled;
+} renderer_gl__texture_load;
+
+static struct {
+  renderer_gl__texture_load **loads;
+  size_t count;
+  size_t capacity;
+  GLuint pixel_buffer;
+} renderer_gl__texture_loads = {0};
+
+static void renderer_gl__texture_decode_job(void *user) {
+  renderer_gl__texture_load *load = user;
+  if (atomic_load(&load->cancelled)) {
+    atomic_store(&load->state, RENDERER_GL__TEXTURE_FAILED);
+    return;
+  }
+  stbi_set_flip_vertically_on_load_thread(1);
+  // always 4 channels, so no row ever needs an unpack alignment below 4
+  load->pixels =
+      stbi_load(load->path, &load->width, &load->height, &load->channels, 4);
+  atomic_store(&load->state, load->pixels ? RENDERER_GL__TEXTURE_DECODED
+                                          : RENDERER_GL__TEXTURE_FAILED);
+}
+
+GLuint renderer_gl_texture_alloc_async(const char *imageFile) {
+  debug_log("Loading texture from '%s' in the background", imageFile);
+  static const unsigned char placeholder[4] = {128, 128, 128, 255};
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  renderer_gl__bind_texture(0, texture);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+               placeholder);
+  renderer_gl__bind_texture(0, 0);
+
+  const size_t path_length = strlen(imageFile);
+  renderer_gl__texture_load *load = calloc(1, sizeof(*load));
+  load->path = malloc(path_length + 1);
+  memcpy(load->path, imageFile, path_length + 1);
+  load->texture = texture;
+  atomic_init(&load->state, RENDERER_GL__TEXTURE_DECODING);
+  atomic_init(&load->cancelled, 0);
+
+  if (renderer_gl__texture_loads.count == renderer_gl__texture_loads.capacity) {
+    const size_t capacity = renderer_gl__texture_loads.capacity;
+    renderer_gl__texture_loads.capacity = capacity ? capacity * 2 : 16;
+    renderer_gl__texture_loads.loads =
+        realloc(renderer_gl__texture_loads.loads,
+                sizeof(*renderer_gl__texture_loads.loads) *
+                    renderer_gl__texture_loads.capacity);
+  }
+  renderer_gl__texture_loads.loads[renderer_gl__texture_loads.count++] = load;
+
+  jobs_submit(renderer_gl__texture_decode_job, load);
+  return texture;
+}
+
+unsigned int renderer_gl_textures_loading(void) {
+  return (unsigned int)renderer_gl__texture_loads.count;
+}
+
+void renderer_gl_texture_free(GLuint texture) {
+  for (size_t i = 0; i < renderer_gl__texture_loads.count; i++) {
+    renderer_gl__texture_load *load = renderer_gl__texture_loads.loads[i];
+    if (load->texture == texture) {
+      atomic_store(&load->cancelled, 1);
+    }
+  }
+  renderer_gl__delete_texture(&texture);
+}
+
+// replaces the placeholder of load with its decoded image. the pixels go
+// through the pixel buffer, so glTexImage2D returns without waiting for the
+// transfer.
+static void
+renderer_gl__texture_upload(const renderer_gl__texture_load *load) {
+  const GLsizeiptr size = (GLsizeiptr)load->width * load->height * 4;
+
+  if (renderer_gl__texture_loads.pixel_buffer == 0) {
+    glGenBuffers(1, &renderer_gl__texture_loads.pixel_buffer);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, renderer_gl__texture_loads.pixel_buffer);
+  // orphans the storage an earlier upload may still be reading
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+
+  const void *pixels = NULL;
+  void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                  GL_MAP_WRITE_BIT |
+                                      GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (mapped) {
+    memcpy(mapped, load->pixels, size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  } else {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    pixels = load->pixels;
+  }
+
+  renderer_gl__bind_texture(0, load->texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, load->channels == 3 ? GL_RGB : GL_RGBA,
+               load->width, load->height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+               pixels);
+  glGenerateMipmap(GL_TEXTURE_2D);
+  renderer_gl__bind_texture(0, 0);
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+static void renderer_gl__texture_load_free(renderer_gl__texture_load *load) {
+  stbi_image_free(load->pixels);
+  free(load->path);
+  free(load);
+}
+
+// Uploads the textures decoded since the last frame, oldest first, until
+// RENDERER_GL_TEXTURE_UPLOAD_BUDGET bytes went out. The first upload of a
+// frame always goes, so textures above the budget still load.
+static void renderer_gl__textures_update(void) {
+  size_t uploaded = 0;
+  size_t kept = 0;
+
+  for (size_t i = 0; i < renderer_gl__texture_loads.count; i++) {
+    renderer_gl__texture_load *load = renderer_gl__texture_loads.loads[i];
+    const int state = atomic_load(&load->state);
+
+    if (state != RENDERER_GL__TEXTURE_DECODING &&
+        atomic_load(&load->cancelled)) {
+      // the texture is gone, nothing to upload or report
+    } else if (state == RENDERER_GL__TEXTURE_DECODED) {
+      const size_t size = (size_t)load->width * load->height * 4;
+      if (uploaded > 0 && uploaded + size > RENDERER_GL_TEXTURE_UPLOAD_BUDGET) {
+        renderer_gl__texture_loads.loads[kept++] = load;
+        continue;
+      }
+      renderer_gl__texture_upload(load);
+      uploaded += size;
+    } else if (state == RENDERER_GL__TEXTURE_FAILED) {
+      debug_error("Failed to load texture from '%s'", load->path);
+    } else {
+      renderer_gl__texture_loads.loads[kept++] = load;
+      continue;
+    }
+
+    renderer_gl__texture_load_free(load);
   }
 
-  const char *shader_source = fb.text;
+  renderer_gl__texture_loads.count = kept;
+}
 
+static GLuint renderer_gl__shader_compile_source(const char *source,
+                                                 GLenum type,
+                                                 const char *name) {
   GLuint shader = glCreateShader(type);
-  glShaderSource(shader, 1, &shader_source, NULL);
+  glShaderSource(shader, 1, &source, NULL);
   glCompileShader(shader);
 
-  file_buffer_free(fb);
-
   { // error check
     int success;
     char infoLog[512];
@@ -93,13 +394,209 @@ GLuint renderer_gl_shader_compile(const char *file_path, GLenum type) {
 
     if (!success) {
       glGetShaderInfoLog(shader, 512, NULL, infoLog);
-      debug_error("failed to compile shader : %s%s", file_path, infoLog);
+      debug_error("failed to compile shader : %s%s", name, infoLog);
     }
   }
 
   return shader;
 }
 
+GLuint renderer_gl_shader_compile(const char *file_path, GLenum type) {
+  debug_log("compiling shader from '%s'", file_path);
+  file_buffer fb = file_buffer_alloc(file_path);
+  if (fb.error) { // error check
+    debug_error("failed to read shader from '%s'\n", file_path);
+  }
+
+  GLuint shader = renderer_gl__shader_compile_source(fb.text, type, file_path);
+
+  file_buffer_free(fb);
+
+  return shader;
+}
+
+typedef struct {
+  GLint type;
+  GLint position;
+  GLint direction;
+  GLint cut_off;
+  GLint outer_cut_off;
+  GLint constant;
+  GLint linear;
+  GLint quadratic;
+  GLint diffuse;
+  GLint specular;
+} renderer_gl__light_locations;
+
+// uniform locations of one shader program, looked up once after linking.
+typedef struct {
+  GLuint program;
+  GLint material_diffuse;
+  GLint material_specular;
+  GLint material_shininess;
+  GLint ambient_light;
+  GLint color;
+  GLint use_instancing;
+  GLint use_multi_draw;
+  GLint use_instance_transforms;
+  GLint model_matrix;
+  GLint camera_matrix;
+  GLint packed_vertices;
+  GLint position_offset;
+  GLint position_scale;
+  GLint lights_count;
+  renderer_gl__light_locations *lights;
+  GLuint lights_capacity;
+  int lights_block;
+  int draws_block;
+} renderer_gl__uniforms;
+SC_LIST(renderer_gl__uniforms)
+
+static sc_list_renderer_gl__uniforms renderer_gl__uniforms_cache = NULL;
+
+static const struct {
+  const char *name;
+  size_t offset;
+} renderer_gl__uniform_names[] = {
+    {"u_material.diffuse", offsetof(renderer_gl__uniforms, material_diffuse)},
+    {"u_material.specular", offsetof(renderer_gl__uniforms, material_specular)},
+    {"u_material.shininess",
+     offsetof(renderer_gl__uniforms, material_shininess)},
+    {"u_ambient_light", offsetof(renderer_gl__uniforms, ambient_light)},
+    {"u_color", offsetof(renderer_gl__uniforms, color)},
+    {"u_use_instancing", offsetof(renderer_gl__uniforms, use_instancing)},
+    {"u_use_multi_draw", offsetof(renderer_gl__uniforms, use_multi_draw)},
+    {"u_use_instance_transforms",
+     offsetof(renderer_gl__uniforms, use_instance_transforms)},
+    {"u_model_matrix", offsetof(renderer_gl__uniforms, model_matrix)},
+    {"u_camera_matrix", offsetof(renderer_gl__uniforms, camera_matrix)},
+    {"u_packed_vertices", offsetof(renderer_gl__uniforms, packed_vertices)},
+    {"u_position_offset", offsetof(renderer_gl__uniforms, position_offset)},
+    {"u_position_scale", offsetof(renderer_gl__uniforms, position_scale)},
+    {"u_lights_count", offsetof(renderer_gl__uniforms, lights_count)},
+};
+
+static const struct {
+  const char *name;
+  size_t offset;
+} renderer_gl__light_uniform_names[] = {
+    {"type", offsetof(renderer_gl__light_locations, type)},
+    {"position", offsetof(renderer_gl__light_locations, position)},
+    {"direction", offsetof(renderer_gl__light_locations, direction)},
+    {"cut_off", offsetof(renderer_gl__light_locations, cut_off)},
+    {"outer_cut_off", offsetof(renderer_gl__light_locations, outer_cut_off)},
+    {"constant", offsetof(renderer_gl__light_locations, constant)},
+    {"linear", offsetof(renderer_gl__light_locations, linear)},
+    {"quadratic", offsetof(renderer_gl__light_locations, quadratic)},
+    {"diffuse", offsetof(renderer_gl__light_locations, diffuse)},
+    {"specular", offsetof(renderer_gl__light_locations, specular)},
+};
+
+// walks the active uniforms of program and records the locations the renderer
+// uploads every draw. uniforms the program does not use stay at -1, which
+// glUniform* silently ignores.
+static renderer_gl__uniforms renderer_gl__uniforms_introspect(GLuint program) {
+  renderer_gl__uniforms uniforms;
+  memset(&uniforms, 0xFF, sizeof(uniforms)); // every location -1
+  uniforms.program = program;
+  uniforms.lights = NULL;
+  uniforms.lights_capacity = 0;
+
+  const GLuint lights_block = glGetProgramResourceIndex(
+      program, GL_SHADER_STORAGE_BLOCK, "renderer_gl_lights_block");
+  uniforms.lights_block = lights_block != GL_INVALID_INDEX;
+  if (uniforms.lights_block) {
+    glShaderStorageBlockBinding(program, lights_block,
+                                RENDERER_GL_LIGHTS_BINDING);
+  }
+
+  const GLuint draws_block = glGetProgramResourceIndex(
+      program, GL_SHADER_STORAGE_BLOCK, "renderer_gl_draws_block");
+  uniforms.draws_block = draws_block != GL_INVALID_INDEX;
+  if (uniforms.draws_block) {
+    glShaderStorageBlockBinding(program, draws_block,
+                                RENDERER_GL_DRAWS_BINDING);
+  }
+
+  GLint uniform_count = 0;
+  glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES,
+                          &uniform_count);
+
+  for (GLint i = 0; i < uniform_count; i++) {
+    char name[128] = {0};
+    glGetProgramResourceName(program, GL_UNIFORM, i, sizeof(name), NULL, name);
+
+    const GLenum property = GL_LOCATION;
+    GLint location = -1;
+    glGetProgramResourceiv(program, GL_UNIFORM, i, 1, &property, 1, NULL,
+                           &location);
+
+    unsigned int light = 0;
+    char member[32] = {0};
+    if (sscanf(name, "u_lights[%u].%31s", &light, member) == 2) {
+      if (light >= uniforms.lights_capacity) {
+        const GLuint capacity = light + 1;
+        uniforms.lights =
+            realloc(uniforms.lights, sizeof(*uniforms.lights) * capacity);
+        memset(uniforms.lights + uniforms.lights_capacity, 0xFF,
+               sizeof(*uniforms.lights) *
+                   (capacity - uniforms.lights_capacity));
+        uniforms.lights_capacity = capacity;
+      }
+
+      sc_foreach(n, sizeof(renderer_gl__light_uniform_names) /
+                        sizeof(*renderer_gl__light_uniform_names)) {
+        if (strcmp(member, renderer_gl__light_uniform_names[n].name) == 0) {
+          *(GLint *)((char *)&uniforms.lights[light] +
+                     renderer_gl__light_uniform_names[n].offset) = location;
+        }
+      }
+      continue;
+    }
+
+    sc_foreach(n, sizeof(renderer_gl__uniform_names) /
+                      sizeof(*renderer_gl__uniform_names)) {
+      if (strcmp(name, renderer_gl__uniform_names[n].name) == 0) {
+        *(GLint *)((char *)&uniforms +
+                   renderer_gl__uniform_names[n].offset) = location;
+      }
+    }
+  }
+
+  return uniforms;
+}
+
+// returns the index of the cached uniform locations of program. programs that
+// were not linked through renderer_gl_shader_link are introspected on first
+// use. entries move when the cache grows or a program is freed, so callers keep
+// the index rather than a pointer into the cache.
+static sc_list_size renderer_gl__uniforms_get(GLuint program) {
+  static sc_list_size last = 0;
+
+  if (renderer_gl__uniforms_cache == NULL) {
+    renderer_gl__uniforms_cache = sc_list_renderer_gl__uniforms_alloc();
+  }
+
+  const sc_list_size count =
+      sc_list_renderer_gl__uniforms_count(renderer_gl__uniforms_cache);
+
+  if (last < count && renderer_gl__uniforms_cache[last].program == program) {
+    return last;
+  }
+
+  for (sc_list_size i = 0; i < count; i++) {
+    if (renderer_gl__uniforms_cache[i].program == program) {
+      last = i;
+      return i;
+    }
+  }
+
+  sc_list_renderer_gl__uniforms_add(&renderer_gl__uniforms_cache,
+                                    renderer_gl__uniforms_introspect(program));
+  last = count;
+  return last;
+}
+
 GLuint renderer_gl_shader_link(GLuint vertex_shader, GLuint fragment_shader) {
   GLuint shader = glCreateProgram();
   glAttachShader(shader, vertex_shader);
@@ -109,20 +606,52 @@ GLuint renderer_gl_shader_link(GLuint vertex_shader, GLuint fragment_shader) {
   glDetachShader(shader, fragment_shader);
   glDeleteShader(vertex_shader);
   glDeleteShader(fragment_shader);
+
+  renderer_gl__uniforms_get(shader);
   return shader;
 }
 
-void renderer_gl__buffer_vertex_array(GLuint *VAO, GLuint *VBO,
-                                      GLuint vertex_count,
-                                      renderer_gl_vertex *vertices) {
-  glGenVertexArrays(1, VAO);
-  glBindVertexArray(*VAO);
+void renderer_gl_shader_free(GLuint shader) {
+  if (renderer_gl__uniforms_cache) {
+    const sc_list_size count =
+        sc_list_renderer_gl__uniforms_count(renderer_gl__uniforms_cache);
+    for (sc_list_size i = 0; i < count; i++) {
+      if (renderer_gl__uniforms_cache[i].program == shader) {
+        free(renderer_gl__uniforms_cache[i].lights);
+        sc_list_renderer_gl__uniforms_remove_at(renderer_gl__uniforms_cache,
+                                                i);
+        break;
+      }
+    }
+  }
 
-  glGenBuffers(1, VBO);
-  glBindBuffer(GL_ARRAY_BUFFER, *VBO);
+  // a new program may get the same name, which has to be bound for real
+  if (renderer_gl__state.program == shader) {
+    renderer_gl__state.program = ~0u;
+  }
+  glDeleteProgram(shader);
+}
 
-  glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(renderer_gl_vertex),
-               vertices, GL_STATIC_DRAW);
+// points attributes 0-2 at the renderer_gl_vertex layout of the bound
+// GL_ARRAY_BUFFER, or the renderer_gl_packed_vertex one, for the bound vertex
+// array.
+static void renderer_gl__vertex_attributes(const int packed) {
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+  glEnableVertexAttribArray(2);
+
+  if (packed) {
+    glVertexAttribPointer(
+        0, 3, GL_SHORT, GL_TRUE, sizeof(renderer_gl_packed_vertex),
+        (void *)offsetof(renderer_gl_packed_vertex, position));
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE,
+                          sizeof(renderer_gl_packed_vertex),
+                          (void *)offsetof(renderer_gl_packed_vertex, normal));
+    glVertexAttribPointer(
+        2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(renderer_gl_packed_vertex),
+        (void *)offsetof(renderer_gl_packed_vertex, texture_coordinates));
+    return;
+  }
 
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(renderer_gl_vertex),
                         (void *)offsetof(renderer_gl_vertex, position));
@@ -133,405 +662,2492 @@ void renderer_gl__buffer_vertex_array(GLuint *VAO, GLuint *VBO,
   glVertexAttribPointer(
       2, 2, GL_FLOAT, GL_FALSE, sizeof(renderer_gl_vertex),
       (void *)offsetof(renderer_gl_vertex, texture_coordinates));
-
-  glEnableVertexAttribArray(0);
-  glEnableVertexAttribArray(1);
-  glEnableVertexAttribArray(2);
 }
 
-void renderer_gl__buffer_element_array(GLuint *VAO, GLuint *VBO, GLuint *EBO,
-                                       GLuint vertex_count,
-                                       renderer_gl_vertex *vertices,
-                                       GLuint indices_count, GLuint *indices) {
+// uploads vertex_count renderer_gl_vertex, or renderer_gl_packed_vertex when
+// packed, into a new buffer behind a new vertex array.
+static void renderer_gl__buffer_vertices(GLuint *VAO, GLuint *VBO,
+                                         GLuint vertex_count,
+                                         const void *vertices,
+                                         const int packed) {
   glGenVertexArrays(1, VAO);
-  glBindVertexArray(*VAO);
+  renderer_gl__bind_vertex_array(*VAO);
 
   glGenBuffers(1, VBO);
   glBindBuffer(GL_ARRAY_BUFFER, *VBO);
 
-  glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(renderer_gl_vertex),
+  glBufferData(GL_ARRAY_BUFFER,
+               vertex_count * (packed ? sizeof(renderer_gl_packed_vertex)
+                                      : sizeof(renderer_gl_vertex)),
                vertices, GL_STATIC_DRAW);
 
+  renderer_gl__vertex_attributes(packed);
+}
+
+void renderer_gl__buffer_vertex_array(GLuint *VAO, GLuint *VBO,
+                                      GLuint vertex_count,
+                                      renderer_gl_vertex *vertices) {
+  renderer_gl__buffer_vertices(VAO, VBO, vertex_count, vertices, 0);
+}
+
+// uploads the vertices and the indices of index_type into new buffers behind a
+// new vertex array.
+static void renderer_gl__buffer_indexed(GLuint *VAO, GLuint *VBO, GLuint *EBO,
+                                        GLuint vertex_count,
+                                        const void *vertices, const int packed,
+                                        GLuint indices_count,
+                                        const GLenum index_type,
+                                        const void *indices) {
+  renderer_gl__buffer_vertices(VAO, VBO, vertex_count, vertices, packed);
+
   glGenBuffers(1, EBO);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *EBO);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(*indices) * indices_count,
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+               indices_count * (index_type == GL_UNSIGNED_SHORT
+                                    ? sizeof(GLushort)
+                                    : sizeof(GLuint)),
                indices, GL_STATIC_DRAW);
+}
 
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(renderer_gl_vertex),
-                        (void *)offsetof(renderer_gl_vertex, position));
+// like renderer_gl__buffer_indexed, storing the indices in 16 bits when every
+// one fits.
+static void renderer_gl__buffer_elements(GLuint *VAO, GLuint *VBO, GLuint *EBO,
+                                         GLenum *index_type,
+                                         GLuint vertex_count,
+                                         const void *vertices,
+                                         const int packed,
+                                         GLuint indices_count,
+                                         const GLuint *indices) {
+  if (vertex_count > 0xFFFF + 1) {
+    *index_type = GL_UNSIGNED_INT;
+    renderer_gl__buffer_indexed(VAO, VBO, EBO, vertex_count, vertices, packed,
+                                indices_count, *index_type, indices);
+    return;
+  }
 
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(renderer_gl_vertex),
-                        (void *)offsetof(renderer_gl_vertex, normal));
+  GLushort *short_indices = malloc(sizeof(*short_indices) * indices_count);
+  for (GLuint i = 0; i < indices_count; i++) {
+    short_indices[i] = (GLushort)indices[i];
+  }
+  *index_type = GL_UNSIGNED_SHORT;
+  renderer_gl__buffer_indexed(VAO, VBO, EBO, vertex_count, vertices, packed,
+                              indices_count, *index_type, short_indices);
+  free(short_indices);
+}
 
-  glVertexAttribPointer(
-      2, 2, GL_FLOAT, GL_FALSE, sizeof(renderer_gl_vertex),
-      (void *)offsetof(renderer_gl_vertex, texture_coordinates));
+void renderer_gl__buffer_element_array(GLuint *VAO, GLuint *VBO, GLuint *EBO,
+                                       GLenum *index_type, GLuint vertex_count,
+                                       renderer_gl_vertex *vertices,
+                                       GLuint indices_count, GLuint *indices) {
+  renderer_gl__buffer_elements(VAO, VBO, EBO, index_type, vertex_count,
+                               vertices, 0, indices_count, indices);
+}
 
-  glEnableVertexAttribArray(0);
-  glEnableVertexAttribArray(1);
-  glEnableVertexAttribArray(2);
+// cache miss rate the overdraw order may give up to draw outside clusters first
+#define RENDERER_GL__OVERDRAW_THRESHOLD (1.05f)
+
+// reorders the triangles of batch for the post transform cache, optionally
+// front to back for less overdraw, then its vertices in order of first use.
+// logs the simulated cache misses before and after.
+static void renderer_gl__mesh_optimize(renderer_gl_batch *batch,
+                                       const int overdraw, const char *name) {
+  const size_t vertex_count = sc_list_renderer_gl_vertex_count(batch->vertices);
+  const size_t index_count = sc_list_GLuint_count(batch->indices);
+  if (vertex_count == 0 || index_count < 6) {
+    return;
+  }
+
+  const mesh_optimize_stats before = mesh_optimize_analyze(
+      batch->indices, index_count, vertex_count, MESH_OPTIMIZE_CACHE_SIZE);
+
+  mesh_optimize_vertex_cache(batch->indices, index_count, vertex_count);
+  if (overdraw) {
+    mesh_optimize_overdraw(batch->indices, index_count,
+                           &batch->vertices[0].position.x,
+                           &batch->vertices[0].normal.x,
+                           sizeof(renderer_gl_vertex), vertex_count,
+                           RENDERER_GL__OVERDRAW_THRESHOLD);
+  }
+  sc_list_renderer_gl_vertex_resize(
+      &batch->vertices,
+      mesh_optimize_vertex_fetch(batch->vertices, sizeof(renderer_gl_vertex),
+                                 batch->indices, index_count, vertex_count));
+
+  const mesh_optimize_stats after = mesh_optimize_analyze(
+      batch->indices, index_count,
+      sc_list_renderer_gl_vertex_count(batch->vertices),
+      MESH_OPTIMIZE_CACHE_SIZE);
+  debug_log("Optimized %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", name,
+            before.acmr, after.acmr, before.atvr, after.atvr);
+}
+
+// keys of the meshes that are not archetypes
+#define RENDERER_GL__MESH_ICOSPHERE (RENDERER_GL__ARCHETYPES_END)
+#define RENDERER_GL__MESH_OBJ (RENDERER_GL__ARCHETYPES_END + 1)
+
+// appended to OBJ paths for their binary mesh file
+#define RENDERER_GL__MESH_FILE ".mesh"
+
+struct renderer_gl_mesh {
+  unsigned int archetype;
+  unsigned int subdivisions;
+  char *path;
+  unsigned int references;
+
+  GLuint VBO;
+  GLuint EBO;
+  GLenum index_type;
+  int packed;
+  vector3 position_offset;
+  vector3 position_scale;
+  sc_list_renderer_gl_vertex vertices;
+  sc_list_GLuint indices;
+  GLenum primitive;
+  vector3 bounds_center;
+  GLfloat bounds_radius;
+
+  // pool location shared by the batches of the mesh, see renderer_gl_batch_pool
+  int pooled;
+  GLint pool_base_vertex;
+  GLuint pool_vertex_count;
+  GLuint pool_first_index;
+  GLuint pool_index_count;
+};
+
+// every mesh still referenced by a batch. there are few distinct meshes, so
+// lookups are a linear search.
+static struct {
+  renderer_gl_mesh **meshes;
+  size_t count;
+  size_t capacity;
+} renderer_gl__meshes = {0};
+
+// points batch at the geometry of mesh, with a vertex array of its own for
+// the instance attributes.
+static void renderer_gl__mesh_attach(renderer_gl_batch *batch,
+                                     renderer_gl_mesh *mesh) {
+  batch->mesh = mesh;
+  batch->VBO = mesh->VBO;
+  batch->EBO = mesh->EBO;
+  batch->index_type = mesh->index_type;
+  batch->packed = mesh->packed;
+  batch->position_offset = mesh->position_offset;
+  batch->position_scale = mesh->position_scale;
+  batch->vertices = mesh->vertices;
+  batch->indices = mesh->indices;
+  batch->primitive = mesh->primitive;
+  batch->bounds_center = mesh->bounds_center;
+  batch->bounds_radius = mesh->bounds_radius;
+
+  glGenVertexArrays(1, &batch->VAO);
+  renderer_gl__bind_vertex_array(batch->VAO);
+  glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+  if (mesh->EBO) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+  }
+  renderer_gl__vertex_attributes(mesh->packed);
 }
 
-void renderer_gl__buffer_matrices(const renderer_gl_batch *batch) {
-  for (unsigned int i = 0; i < batch->count * 16; i += 16) {
-    mat4_identity(batch->matrices + i);
+static renderer_gl_mesh *
+renderer_gl__mesh_find(const unsigned int archetype,
+                       const unsigned int subdivisions, const char *path,
+                       const int packed) {
+  for (size_t i = 0; i < renderer_gl__meshes.count; i++) {
+    renderer_gl_mesh *mesh = renderer_gl__meshes.meshes[i];
+    if (mesh->archetype == archetype && mesh->subdivisions == subdivisions &&
+        mesh->packed == packed &&
+        (path == NULL || strcmp(mesh->path, path) == 0)) {
+      return mesh;
+    }
+  }
 
-    batch->matrices[0 + i] = batch->transform[i / 16].scale.x;
-    batch->matrices[5 + i] = batch->transform[i / 16].scale.y;
-    batch->matrices[10 + i] = batch->transform[i / 16].scale.z;
-    batch->matrices[12 + i] = batch->transform[i / 16].position.x;
-    batch->matrices[13 + i] = batch->transform[i / 16].position.y;
-    batch->matrices[14 + i] = batch->transform[i / 16].position.z;
+  return NULL;
+}
 
-    GLfloat rotation[16] = {0};
-    quaternion_to_mat4(batch->transform[i / 16].rotation, rotation);
-    mat4_multiply(batch->matrices + i, batch->matrices + i, rotation);
+// shares the cached mesh for the key with batch. returns 0 when there is none
+// yet and the caller has to build the geometry.
+static int renderer_gl__mesh_acquire(renderer_gl_batch *batch,
+                                     const unsigned int archetype,
+                                     const unsigned int subdivisions,
+                                     const char *path) {
+  renderer_gl_mesh *mesh =
+      renderer_gl__mesh_find(archetype, subdivisions, path, 0);
+  if (mesh == NULL) {
+    return 0;
   }
 
-  // --------------------------------------------------------------------------
-  // configure instanced array
+  mesh->references++;
+  renderer_gl__mesh_attach(batch, mesh);
+  return 1;
+}
 
-  glBindBuffer(GL_ARRAY_BUFFER, batch->model_matrix_buffer);
+// moves the geometry batch just built into the cache under the key.
+static void renderer_gl__mesh_insert(renderer_gl_batch *batch,
+                                     const unsigned int archetype,
+                                     const unsigned int subdivisions,
+                                     const char *path) {
+  renderer_gl_mesh *mesh = malloc(sizeof(*mesh));
+  *mesh = (renderer_gl_mesh){
+      .archetype = archetype,
+      .subdivisions = subdivisions,
+      .references = 1,
+      .VBO = batch->VBO,
+      .EBO = batch->EBO,
+      .index_type = batch->index_type,
+      .packed = batch->packed,
+      .position_offset = batch->position_offset,
+      .position_scale = batch->position_scale,
+      .vertices = batch->vertices,
+      .indices = batch->indices,
+      .primitive = batch->primitive,
+      .bounds_center = batch->bounds_center,
+      .bounds_radius = batch->bounds_radius,
+  };
+  if (path) {
+    mesh->path = malloc(strlen(path) + 1);
+    strcpy(mesh->path, path);
+  }
 
-  glBufferData(GL_ARRAY_BUFFER, batch->count * sizeof(GLfloat) * 16,
-               &batch->matrices[0], GL_STATIC_DRAW);
+  if (renderer_gl__meshes.count == renderer_gl__meshes.capacity) {
+    renderer_gl__meshes.capacity = renderer_gl__meshes.capacity * 2 + 8;
+    renderer_gl__meshes.meshes =
+        realloc(renderer_gl__meshes.meshes,
+                sizeof(*renderer_gl__meshes.meshes) *
+                    renderer_gl__meshes.capacity);
+  }
+  renderer_gl__meshes.meshes[renderer_gl__meshes.count++] = mesh;
 
-  glBindVertexArray(batch->VAO);
+  batch->mesh = mesh;
+}
 
-  // set attribute pointers for matrix (4 times vec4)
-  glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 16,
-                        (void *)0);
+static renderer_gl_instance_stream *
+renderer_gl__instance_stream_alloc(GLuint buffer, const unsigned int count) {
+  if (!GLAD_GL_VERSION_4_4 && !GLAD_GL_ARB_buffer_storage) {
+    return NULL;
+  }
 
-  glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 16,
-                        (void *)(1 * sizeof(vector4)));
+  renderer_gl_instance_stream *stream = calloc(sizeof(*stream), 1);
+  stream->region_size = count * sizeof(GLfloat) * 16;
 
-  glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 16,
-                        (void *)(2 * sizeof(vector4)));
+  const GLbitfield flags =
+      GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
 
-  glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 16,
-                        (void *)(3 * sizeof(vector4)));
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glBufferStorage(GL_ARRAY_BUFFER,
+                  stream->region_size * RENDERER_GL_INSTANCE_STREAM_REGIONS,
+                  NULL, flags);
+  stream->mapped = glMapBufferRange(
+      GL_ARRAY_BUFFER, 0,
+      stream->region_size * RENDERER_GL_INSTANCE_STREAM_REGIONS, flags);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-  glEnableVertexAttribArray(3);
-  glEnableVertexAttribArray(4);
-  glEnableVertexAttribArray(5);
-  glEnableVertexAttribArray(6);
+  if (stream->mapped == NULL) {
+    debug_warn("Failed to map instance stream. Falling back to glBufferData");
+    free(stream);
+    return NULL;
+  }
 
-  glVertexAttribDivisor(3, 1);
-  glVertexAttribDivisor(4, 1);
-  glVertexAttribDivisor(5, 1);
-  glVertexAttribDivisor(6, 1);
+  return stream;
+}
+
+static void
+renderer_gl__instance_stream_free(renderer_gl_instance_stream *stream) {
+  if (stream == NULL) {
+    return;
+  }
+
+  for (unsigned int i = 0; i < RENDERER_GL_INSTANCE_STREAM_REGIONS; i++) {
+    if (stream->fences[i]) {
+      glDeleteSync(stream->fences[i]);
+    }
+  }
+
+  free(stream);
+}
+
+// blocks until the GPU has finished reading the region guarded by fence.
+static void renderer_gl__fence_wait(GLsync *fence) {
+  if (*fence == NULL) {
+    return;
+  }
+
+  GLbitfield flags = 0;
+  GLuint64 timeout = 0;
+  for (;;) {
+    const GLenum status = glClientWaitSync(*fence, flags, timeout);
+    if (status != GL_TIMEOUT_EXPIRED) {
+      break;
+    }
+    flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    timeout = 1000000; // 1ms
+  }
+
+  glDeleteSync(*fence);
+  *fence = NULL;
+}
+
+renderer_gl_transforms renderer_gl_transforms_alloc(const unsigned int count) {
+  // every stream is rounded up to whole lines, so the next one stays aligned.
+  // the padding holds identities too, SIMD loops may run over it.
+  const size_t line = RENDERER_GL_TRANSFORMS_ALIGNMENT / sizeof(GLfloat);
+  const size_t length = (count + line - 1) / line * line;
+
+  renderer_gl_transforms transforms;
+  transforms.block = malloc(sizeof(GLfloat) * length * 10 +
+                            RENDERER_GL_TRANSFORMS_ALIGNMENT);
+  GLfloat *streams =
+      (GLfloat *)(((uintptr_t)transforms.block +
+                   RENDERER_GL_TRANSFORMS_ALIGNMENT - 1) &
+                  ~(uintptr_t)(RENDERER_GL_TRANSFORMS_ALIGNMENT - 1));
+
+  for (int k = 0; k < 3; k++) {
+    transforms.position[k] = streams + k * length;
+    transforms.scale[k] = streams + (7 + k) * length;
+  }
+  for (int k = 0; k < 4; k++) {
+    transforms.rotation[k] = streams + (3 + k) * length;
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    for (int k = 0; k < 3; k++) {
+      transforms.position[k][i] = 0;
+      transforms.rotation[k][i] = 0;
+      transforms.scale[k][i] = 1;
+    }
+    transforms.rotation[3][i] = 1;
+  }
+
+  return transforms;
+}
+
+void renderer_gl_transforms_free(renderer_gl_transforms transforms) {
+  free(transforms.block);
+}
+
+renderer_gl_transform
+renderer_gl_transforms_get(const renderer_gl_transforms *transforms,
+                           const unsigned int index) {
+  return (renderer_gl_transform){
+      .position = {transforms->position[0][index],
+                   transforms->position[1][index],
+                   transforms->position[2][index]},
+      .scale = {transforms->scale[0][index], transforms->scale[1][index],
+                transforms->scale[2][index]},
+      .rotation = {transforms->rotation[0][index],
+                   transforms->rotation[1][index],
+                   transforms->rotation[2][index],
+                   transforms->rotation[3][index]},
+  };
+}
+
+void renderer_gl_transforms_set(renderer_gl_transforms *transforms,
+                                const unsigned int index,
+                                const renderer_gl_transform transform) {
+  transforms->position[0][index] = transform.position.x;
+  transforms->position[1][index] = transform.position.y;
+  transforms->position[2][index] = transform.position.z;
+  transforms->rotation[0][index] = transform.rotation.x;
+  transforms->rotation[1][index] = transform.rotation.y;
+  transforms->rotation[2][index] = transform.rotation.z;
+  transforms->rotation[3][index] = transform.rotation.w;
+  transforms->scale[0][index] = transform.scale.x;
+  transforms->scale[1][index] = transform.scale.y;
+  transforms->scale[2][index] = transform.scale.z;
+}
+
+// stream k of transforms: position xyz, rotation xyzw, then scale xyz.
+static GLfloat *renderer_gl__transform_stream(
+    const renderer_gl_transforms *transforms, const int k) {
+  return k < 3   ? transforms->position[k]
+         : k < 7 ? transforms->rotation[k - 3]
+                 : transforms->scale[k - 7];
+}
+
+// describes the streams of transforms from instance first on as
+// mat4_trs_streams.
+static mat4_trs_streams
+renderer_gl__transform_streams(const renderer_gl_transforms *transforms,
+                               const size_t first) {
+  return (mat4_trs_streams){
+      .position = {transforms->position[0] + first,
+                   transforms->position[1] + first,
+                   transforms->position[2] + first},
+      .rotation = {transforms->rotation[0] + first,
+                   transforms->rotation[1] + first,
+                   transforms->rotation[2] + first,
+                   transforms->rotation[3] + first},
+      .scale = {transforms->scale[0] + first, transforms->scale[1] + first,
+                transforms->scale[2] + first},
+      .stride = 1,
+  };
+}
+
+static void renderer_gl__build_matrix(const renderer_gl_transforms *transforms,
+                                      const unsigned int index,
+                                      GLfloat *matrix) {
+  const renderer_gl_transform transform =
+      renderer_gl_transforms_get(transforms, index);
+  mat4_from_trs(matrix, transform.position, transform.rotation,
+                transform.scale);
+}
+
+typedef struct {
+  const renderer_gl_batch *batch;
+  GLfloat *matrices;
+} renderer_gl__matrix_job;
+
+static void renderer_gl__build_matrices_job(void *user, size_t begin,
+                                            size_t end) {
+  const renderer_gl__matrix_job *job = user;
+  const mat4_trs_streams streams =
+      renderer_gl__transform_streams(&job->batch->transforms, begin);
+  mat4_from_trs_batch(job->matrices + begin * 16, &streams, end - begin);
+}
+
+// builds every instance matrix of the batch into matrices, split across the
+// job system for large batches.
+static void renderer_gl__build_matrices(const renderer_gl_batch *batch,
+                                        GLfloat *matrices) {
+  renderer_gl__matrix_job job = {.batch = batch, .matrices = matrices};
+  jobs_parallel_for(batch->count, RENDERER_GL__MATRIX_JOB_GRAIN,
+                    renderer_gl__build_matrices_job, &job);
+}
+
+// rebuilds the cached matrices of the dirty list entries in [begin, end).
+// every entry is a distinct instance so the ranges never write the same data.
+static void renderer_gl__build_dirty_matrices_job(void *user, size_t begin,
+                                                  size_t end) {
+  const renderer_gl_batch *batch = user;
+  for (size_t i = begin; i < end; i++) {
+    const GLuint index = batch->dirty_indices[i];
+    if (batch->dirty[index] & RENDERER_GL__DIRTY_MATRIX) {
+      renderer_gl__build_matrix(&batch->transforms, index,
+                                batch->matrices + index * 16);
+      batch->dirty[index] &= ~RENDERER_GL__DIRTY_MATRIX;
+    }
+  }
+}
+
+void renderer_gl_batch_transform_dirty(renderer_gl_batch *batch,
+                                       const unsigned int index) {
+  assert(index < batch->count);
+  if (batch->dirty[index] == 0) {
+    sc_list_GLuint_add(&batch->dirty_indices, index);
+  }
+  batch->dirty[index] = RENDERER_GL__DIRTY_ALL;
+}
+
+void renderer_gl_batch_transform_set(renderer_gl_batch *batch,
+                                     const unsigned int index,
+                                     const renderer_gl_transform transform) {
+  assert(index < batch->count);
+  renderer_gl_transforms_set(&batch->transforms, index, transform);
+  renderer_gl_batch_transform_dirty(batch, index);
+}
+
+// Rebuilds the matrices of dirty instances only and copies them to the mapped
+// region. An instance stays in the dirty list until every region of the ring
+// has received its new matrix.
+static void renderer_gl__stream_dirty_matrices(const renderer_gl_batch *batch,
+                                               GLfloat *region_matrices,
+                                               const GLuint region) {
+  const unsigned char region_bit = RENDERER_GL__DIRTY_REGION(region);
+
+  jobs_parallel_for(sc_list_GLuint_count(batch->dirty_indices),
+                    RENDERER_GL__MATRIX_JOB_GRAIN,
+                    renderer_gl__build_dirty_matrices_job, (void *)batch);
+
+  for (sc_list_size i = sc_list_GLuint_count(batch->dirty_indices); i-- > 0;) {
+    const GLuint index = batch->dirty_indices[i];
+
+    if (batch->dirty[index] & region_bit) {
+      memcpy(region_matrices + index * 16, batch->matrices + index * 16,
+             sizeof(GLfloat) * 16);
+    }
+
+    batch->dirty[index] &= ~region_bit;
+    if (batch->dirty[index] == 0) {
+      sc_list_GLuint_remove_at(batch->dirty_indices, i);
+    }
+  }
+}
+
+// Rebuilds the matrices of dirty instances only and uploads the smallest range
+// covering them with glBufferSubData.
+static void renderer_gl__upload_dirty_matrices(const renderer_gl_batch *batch) {
+  const sc_list_size dirty_count = sc_list_GLuint_count(batch->dirty_indices);
+  if (dirty_count == 0) {
+    return;
+  }
+
+  jobs_parallel_for(dirty_count, RENDERER_GL__MATRIX_JOB_GRAIN,
+                    renderer_gl__build_dirty_matrices_job, (void *)batch);
+
+  GLuint first = batch->count;
+  GLuint last = 0;
+  for (sc_list_size i = dirty_count; i-- > 0;) {
+    const GLuint index = batch->dirty_indices[i];
+    first = index < first ? index : first;
+    last = index > last ? index : last;
+    batch->dirty[index] = 0;
+    sc_list_GLuint_remove_at(batch->dirty_indices, i);
+  }
+
+  glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(GLfloat) * 16,
+                  (last - first + 1) * sizeof(GLfloat) * 16,
+                  batch->matrices + first * 16);
+}
+
+// frustum planes of the last renderer_gl_camera_update. all zero until then,
+// which lets every sphere through.
+static struct {
+  vector4 planes[6];
+  GLuint *visible;
+  size_t capacity;
+} renderer_gl__cull = {0};
+
+void renderer_gl_batch_bounds_update(renderer_gl_batch *batch) {
+  const sc_list_size count =
+      batch->vertices ? sc_list_renderer_gl_vertex_count(batch->vertices) : 0;
+  if (count == 0) {
+    batch->bounds_center = (vector3){0, 0, 0};
+    batch->bounds_radius = 0;
+    return;
+  }
+
+  vector3 min = batch->vertices[0].position;
+  vector3 max = batch->vertices[0].position;
+  for (sc_list_size i = 1; i < count; i++) {
+    min = vector3_min(min, batch->vertices[i].position);
+    max = vector3_max(max, batch->vertices[i].position);
+  }
+
+  batch->bounds_center = vector3_scaled(vector3_add(min, max), 0.5f);
+  GLfloat radius = 0;
+  for (sc_list_size i = 0; i < count; i++) {
+    radius = fmaxf(radius, vector3_square_distance(
+                               batch->bounds_center,
+                               batch->vertices[i].position));
+  }
+  batch->bounds_radius = sqrtf(radius);
+}
+
+static void renderer_gl__cull_reserve(const size_t count) {
+  if (count > renderer_gl__cull.capacity) {
+    renderer_gl__cull.capacity = count;
+    renderer_gl__cull.visible =
+        realloc(renderer_gl__cull.visible,
+                sizeof(*renderer_gl__cull.visible) * count);
+  }
+}
+
+// tests the bounding spheres of the first count matrices of batch and writes
+// the indices of the visible ones to renderer_gl__cull.visible.
+static GLuint renderer_gl__cull_matrices(const renderer_gl_batch *batch,
+                                         const GLfloat *matrices,
+                                         const GLuint count) {
+  renderer_gl__cull_reserve(count);
+
+  const GLuint visible = frustum_cull_spheres(
+      renderer_gl__cull.visible, matrices, count, renderer_gl__cull.planes,
+      batch->bounds_center, batch->bounds_radius);
+
+  renderer_gl__active_context->instances_tested += count;
+  renderer_gl__active_context->instances_visible += visible;
+  return visible;
+}
+
+// true unless batch is a culled, non instanced batch outside the frustum.
+// instanced batches are culled per instance when their matrices are buffered.
+static int renderer_gl__visible(const renderer_gl_batch *batch) {
+  if ((batch->render_flags & RENDERER_GL_FLAG_USE_CULLING) == 0 ||
+      (batch->render_flags & RENDERER_GL_FLAG_USE_INSTANCING)) {
+    return 1;
+  }
+
+  renderer_gl__build_matrix(&batch->transforms, 0, batch->matrices);
+  return renderer_gl__cull_matrices(batch, batch->matrices, 1) == 1;
+}
+
+// world bounding sphere of batch moved by model matrix m, as center xyz and
+// radius w
+static vector4 renderer_gl__matrix_sphere(const renderer_gl_batch *batch,
+                                          const GLfloat *m) {
+  const vector3 c = batch->bounds_center;
+  GLfloat scale = 0;
+  for (int axis = 0; axis < 3; axis++) {
+    const GLfloat *a = m + axis * 4;
+    scale = fmaxf(scale, a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+  }
+
+  return (vector4){
+      m[12] + m[0] * c.x + m[4] * c.y + m[8] * c.z,
+      m[13] + m[1] * c.x + m[5] * c.y + m[9] * c.z,
+      m[14] + m[2] * c.x + m[6] * c.y + m[10] * c.z,
+      batch->bounds_radius * sqrtf(scale),
+  };
+}
+
+// tests the bounding spheres of every instance of batch straight from its
+// transform streams and writes the indices of the visible ones to
+// renderer_gl__cull.visible.
+static GLuint renderer_gl__cull_transforms(const renderer_gl_batch *batch) {
+  renderer_gl__cull_reserve(batch->count);
+
+  const mat4_trs_streams streams =
+      renderer_gl__transform_streams(&batch->transforms, 0);
+  const GLuint visible = frustum_cull_trs_spheres(
+      renderer_gl__cull.visible, &streams, batch->count,
+      renderer_gl__cull.planes, batch->bounds_center, batch->bounds_radius);
+
+  renderer_gl__active_context->instances_tested += batch->count;
+  renderer_gl__active_context->instances_visible += visible;
+  return visible;
+}
+
+// world bounding sphere of one instance as center xyz and radius w
+static vector4 renderer_gl__instance_sphere(const renderer_gl_batch *batch,
+                                            const unsigned int instance) {
+  GLfloat m[16];
+  renderer_gl__build_matrix(&batch->transforms, instance, m);
+  return renderer_gl__matrix_sphere(batch, m);
+}
+
+static void renderer_gl__scene_bounds_job(void *user, size_t begin,
+                                          size_t end) {
+  renderer_gl_scene *scene = user;
+  for (size_t i = begin; i < end; i++) {
+    const renderer_gl_scene_item item = scene->items[i];
+    const vector4 s = renderer_gl__instance_sphere(item.batch, item.instance);
+    const vector3 extent = {s.w, s.w, s.w};
+    const vector3 center = {s.x, s.y, s.z};
+    scene->spheres[i] = s;
+    scene->bounds[i] = (bvh_aabb){
+        .min = vector3_sub(center, extent),
+        .max = vector3_add(center, extent),
+    };
+  }
+}
+
+void renderer_gl_scene_build(renderer_gl_scene *scene,
+                             renderer_gl_batch **batches,
+                             const unsigned int batch_count) {
+  unsigned int count = 0;
+  for (unsigned int i = 0; i < batch_count; i++) {
+    count += batches[i]->count;
+  }
+
+  scene->items = realloc(scene->items, sizeof(*scene->items) * count);
+  scene->spheres = realloc(scene->spheres, sizeof(*scene->spheres) * count);
+  scene->bounds = realloc(scene->bounds, sizeof(*scene->bounds) * count);
+  scene->count = count;
+
+  unsigned int item = 0;
+  for (unsigned int i = 0; i < batch_count; i++) {
+    for (unsigned int instance = 0; instance < batches[i]->count; instance++) {
+      scene->items[item++] = (renderer_gl_scene_item){batches[i], instance};
+    }
+  }
+
+  jobs_parallel_for(count, RENDERER_GL__MATRIX_JOB_GRAIN,
+                    renderer_gl__scene_bounds_job, scene);
+  bvh_build(&scene->tree, scene->bounds, count);
+  scene->built_cost = bvh_cost(&scene->tree);
+}
+
+void renderer_gl_scene_free(renderer_gl_scene *scene) {
+  bvh_free(&scene->tree);
+  free(scene->items);
+  free(scene->spheres);
+  free(scene->bounds);
+  *scene = (renderer_gl_scene){0};
+}
+
+void renderer_gl_scene_refit(renderer_gl_scene *scene) {
+  jobs_parallel_for(scene->count, RENDERER_GL__MATRIX_JOB_GRAIN,
+                    renderer_gl__scene_bounds_job, scene);
+  bvh_refit(&scene->tree, scene->bounds);
+
+  if (bvh_cost(&scene->tree) > scene->built_cost * 2) {
+    bvh_build(&scene->tree, scene->bounds, scene->count);
+    scene->built_cost = bvh_cost(&scene->tree);
+  }
+}
+
+void renderer_gl_scene_cull(const renderer_gl_scene *scene,
+                            bvh_visit_function visit, void *user) {
+  bvh_query_frustum(&scene->tree, renderer_gl__cull.planes, visit, user);
+}
+
+// ray against the instance sphere, 0 when the ray starts inside it
+static float renderer_gl__scene_ray(void *user, unsigned int item,
+                                    vector3 origin, vector3 direction) {
+  const vector4 s = ((const renderer_gl_scene *)user)->spheres[item];
+  const vector3 offset = vector3_sub(origin, (vector3){s.x, s.y, s.z});
+
+  const float a = vector3_dot(direction, direction);
+  const float b = vector3_dot(direction, offset);
+  const float c = vector3_dot(offset, offset) - s.w * s.w;
+  if (c <= 0) {
+    return 0;
+  }
+
+  const float discriminant = b * b - a * c;
+  if (discriminant < 0 || b > 0) {
+    return -1;
+  }
+  return (-b - sqrtf(discriminant)) / a;
+}
+
+static float renderer_gl__scene_distance(void *user, unsigned int item,
+                                         vector3 point) {
+  const vector4 s = ((const renderer_gl_scene *)user)->spheres[item];
+  const float distance =
+      vector3_distance(point, (vector3){s.x, s.y, s.z}) - s.w;
+  return distance > 0 ? distance * distance : 0;
+}
+
+int renderer_gl_scene_pick(const renderer_gl_scene *scene, vector3 origin,
+                           vector3 direction, renderer_gl_scene_item *hit) {
+  const unsigned int item =
+      bvh_query_ray(&scene->tree, origin, direction, renderer_gl__scene_ray,
+                    (void *)scene, NULL);
+  if (item == BVH_NONE) {
+    return 0;
+  }
+  *hit = scene->items[item];
+  return 1;
+}
+
+int renderer_gl_scene_nearest(const renderer_gl_scene *scene, vector3 point,
+                              renderer_gl_scene_item *nearest) {
+  const unsigned int item =
+      bvh_query_nearest(&scene->tree, point, renderer_gl__scene_distance,
+                        (void *)scene, NULL);
+  if (item == BVH_NONE) {
+    return 0;
+  }
+  *nearest = scene->items[item];
+  return 1;
+}
+
+typedef struct {
+  const GLfloat *matrices;
+  const GLuint *visible;
+  GLfloat *target;
+} renderer_gl__compact_job;
+
+static void renderer_gl__compact_matrices_job(void *user, size_t begin,
+                                              size_t end) {
+  const renderer_gl__compact_job *job = user;
+  for (size_t i = begin; i < end; i++) {
+    memcpy(job->target + i * 16, job->matrices + job->visible[i] * 16,
+           sizeof(GLfloat) * 16);
+  }
+}
+
+// brings the cached matrices of batch up to date, only the dirty ones with
+// RENDERER_GL_FLAG_USE_DIRTY_TRACKING. the culling and level of detail paths
+// that call it rewrite every matrix they draw from the cache, so the dirty
+// list is drained here.
+static void renderer_gl__update_matrices(const renderer_gl_batch *batch) {
+  const sc_list_size dirty_count = sc_list_GLuint_count(batch->dirty_indices);
+
+  if (batch->render_flags & RENDERER_GL_FLAG_USE_DIRTY_TRACKING) {
+    jobs_parallel_for(dirty_count, RENDERER_GL__MATRIX_JOB_GRAIN,
+                      renderer_gl__build_dirty_matrices_job, (void *)batch);
+  } else {
+    renderer_gl__build_matrices(batch, batch->matrices);
+  }
+
+  for (sc_list_size i = dirty_count; i-- > 0;) {
+    batch->dirty[batch->dirty_indices[i]] = 0;
+    sc_list_GLuint_remove_at(batch->dirty_indices, i);
+  }
+}
+
+// Brings the cached matrices of batch up to date, culls them, and packs the
+// visible ones to the front of region_matrices, or of the matrix buffer when
+// the batch has no instance stream. Returns how many instances to draw.
+static GLuint
+renderer_gl__buffer_visible_matrices(const renderer_gl_batch *batch,
+                                     GLfloat *region_matrices) {
+  renderer_gl__update_matrices(batch);
+
+  const GLuint visible =
+      renderer_gl__cull_matrices(batch, batch->matrices, batch->count);
+
+  GLfloat *target = region_matrices;
+  if (target == NULL) {
+    target = glMapBufferRange(GL_ARRAY_BUFFER, 0,
+                              batch->count * sizeof(GLfloat) * 16,
+                              GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (target == NULL) {
+      debug_error("Failed to map the instance buffer for culling");
+      return 0;
+    }
+  }
+
+  renderer_gl__compact_job job = {
+      .matrices = batch->matrices,
+      .visible = renderer_gl__cull.visible,
+      .target = target,
+  };
+  jobs_parallel_for(visible, RENDERER_GL__MATRIX_JOB_GRAIN,
+                    renderer_gl__compact_matrices_job, &job);
+
+  if (region_matrices == NULL) {
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+  }
+
+  return visible;
+}
+
+// points attributes 3-6 at the model matrices starting offset bytes into the
+// bound GL_ARRAY_BUFFER, one matrix per instance, for the bound vertex array.
+static void renderer_gl__instance_attributes(const GLintptr offset) {
+  // set attribute pointers for matrix (4 times vec4)
+  glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 16,
+                        (void *)(offset + 0 * sizeof(vector4)));
+
+  glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 16,
+                        (void *)(offset + 1 * sizeof(vector4)));
+
+  glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 16,
+                        (void *)(offset + 2 * sizeof(vector4)));
+
+  glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 16,
+                        (void *)(offset + 3 * sizeof(vector4)));
+
+  glEnableVertexAttribArray(3);
+  glEnableVertexAttribArray(4);
+  glEnableVertexAttribArray(5);
+  glEnableVertexAttribArray(6);
+
+  glVertexAttribDivisor(3, 1);
+  glVertexAttribDivisor(4, 1);
+  glVertexAttribDivisor(5, 1);
+  glVertexAttribDivisor(6, 1);
+}
+
+// moves the instance stream of batch to its next region once the GPU is done
+// reading it. returns the mapping of the region and its offset in the buffer.
+static GLfloat *renderer_gl__stream_acquire(const renderer_gl_batch *batch,
+                                           GLintptr *offset) {
+  renderer_gl_instance_stream *stream = batch->instance_stream;
+  stream->region = (stream->region + 1) % RENDERER_GL_INSTANCE_STREAM_REGIONS;
+  renderer_gl__fence_wait(&stream->fences[stream->region]);
+
+  *offset = stream->region * stream->region_size;
+  return stream->mapped + *offset / sizeof(GLfloat);
+}
+
+// guards the current region of the instance stream of batch until the draws
+// issued so far are done.
+static void renderer_gl__stream_release(const renderer_gl_batch *batch) {
+  renderer_gl_instance_stream *stream = batch->instance_stream;
+  stream->fences[stream->region] =
+      glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// Uploads the instance matrices of batch and returns how many instances to
+// draw, which is less than batch->count when instances were culled.
+static GLuint renderer_gl__buffer_matrices(const renderer_gl_batch *batch) {
+  GLintptr offset = 0;
+  GLuint instance_count = batch->count;
+  const int use_dirty_tracking =
+      batch->render_flags & RENDERER_GL_FLAG_USE_DIRTY_TRACKING;
+  // also reached by RENDERER_GL_FLAG_USE_GPU_CULLING without compute shaders
+  const int use_culling =
+      batch->render_flags &
+      (RENDERER_GL_FLAG_USE_CULLING | RENDERER_GL_FLAG_USE_GPU_CULLING);
+
+  glBindBuffer(GL_ARRAY_BUFFER, batch->model_matrix_buffer);
+
+  if (batch->instance_stream) {
+    // write straight into the next region of the persistent mapping once the
+    // GPU is done with it. no reallocation, no copy.
+    GLfloat *region_matrices = renderer_gl__stream_acquire(batch, &offset);
+
+    if (use_culling) {
+      instance_count =
+          renderer_gl__buffer_visible_matrices(batch, region_matrices);
+    } else if (use_dirty_tracking) {
+      renderer_gl__stream_dirty_matrices(batch, region_matrices,
+                                         batch->instance_stream->region);
+    } else {
+      renderer_gl__build_matrices(batch, region_matrices);
+    }
+  } else if (use_culling) {
+    instance_count = renderer_gl__buffer_visible_matrices(batch, NULL);
+  } else if (use_dirty_tracking) {
+    renderer_gl__upload_dirty_matrices(batch);
+  } else {
+    renderer_gl__build_matrices(batch, batch->matrices);
+    glBufferData(GL_ARRAY_BUFFER, batch->count * sizeof(GLfloat) * 16,
+                 &batch->matrices[0], GL_STATIC_DRAW);
+  }
+
+  renderer_gl__bind_vertex_array(batch->VAO);
+  renderer_gl__instance_attributes(offset);
+
+  return instance_count;
+}
+
+// points attributes 3-5 at the position, scale and rotation of the transforms
+// starting offset bytes into the bound GL_ARRAY_BUFFER, one per instance, for
+// the bound vertex array. attribute 6 is left at its default.
+static void renderer_gl__instance_transform_attributes(const GLintptr offset) {
+  const GLsizei stride = sizeof(renderer_gl_transform);
+
+  glVertexAttribPointer(
+      3, 3, GL_FLOAT, GL_FALSE, stride,
+      (void *)(offset + offsetof(renderer_gl_transform, position)));
+
+  glVertexAttribPointer(
+      4, 3, GL_FLOAT, GL_FALSE, stride,
+      (void *)(offset + offsetof(renderer_gl_transform, scale)));
+
+  glVertexAttribPointer(
+      5, 4, GL_FLOAT, GL_FALSE, stride,
+      (void *)(offset + offsetof(renderer_gl_transform, rotation)));
+
+  glEnableVertexAttribArray(3);
+  glEnableVertexAttribArray(4);
+  glEnableVertexAttribArray(5);
+  glDisableVertexAttribArray(6);
+
+  glVertexAttribDivisor(3, 1);
+  glVertexAttribDivisor(4, 1);
+  glVertexAttribDivisor(5, 1);
+}
+
+typedef struct {
+  const renderer_gl_transforms *transforms;
+  // instance of every target slot, or NULL for first + slot
+  const GLuint *indices;
+  GLuint first;
+  renderer_gl_transform *target;
+} renderer_gl__gather_job;
+
+static void renderer_gl__gather_transforms_job(void *user, size_t begin,
+                                               size_t end) {
+  const renderer_gl__gather_job *job = user;
+  for (size_t i = begin; i < end; i++) {
+    const GLuint index =
+        job->indices ? job->indices[i] : job->first + (GLuint)i;
+    job->target[i] = renderer_gl_transforms_get(job->transforms, index);
+  }
+}
+
+// Interleaves the transforms of the visible instances of batch into the
+// instance buffer for RENDERER_GL_FLAG_USE_INSTANCE_TRANSFORMS and returns
+// how many instances to draw. Nothing is built on the CPU, culling packs the
+// visible transforms and dirty tracking without a stream only writes the
+// range covering the dirty ones.
+static GLuint renderer_gl__buffer_transforms(const renderer_gl_batch *batch) {
+  const size_t transform_size = sizeof(renderer_gl_transform);
+  GLintptr offset = 0;
+  const int use_dirty_tracking =
+      batch->render_flags & RENDERER_GL_FLAG_USE_DIRTY_TRACKING;
+  const int use_culling =
+      batch->render_flags &
+      (RENDERER_GL_FLAG_USE_CULLING | RENDERER_GL_FLAG_USE_GPU_CULLING);
+
+  renderer_gl__gather_job job = {.transforms = &batch->transforms};
+  GLuint count = batch->count;
+  if (use_culling) {
+    job.indices = renderer_gl__cull.visible;
+    count = renderer_gl__cull_transforms(batch);
+  }
+
+  const sc_list_size dirty_count = sc_list_GLuint_count(batch->dirty_indices);
+  const int dirty_range =
+      !use_culling && use_dirty_tracking && batch->instance_stream == NULL;
+  if (dirty_range) {
+    GLuint last = 0;
+    job.first = batch->count;
+    for (sc_list_size i = 0; i < dirty_count; i++) {
+      const GLuint index = batch->dirty_indices[i];
+      job.first = index < job.first ? index : job.first;
+      last = index > last ? index : last;
+    }
+    count = dirty_count ? last - job.first + 1 : 0;
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, batch->model_matrix_buffer);
+
+  if (batch->instance_stream) {
+    job.target = (renderer_gl_transform *)renderer_gl__stream_acquire(
+        batch, &offset);
+  } else if (count > 0) {
+    job.target = glMapBufferRange(
+        GL_ARRAY_BUFFER, job.first * transform_size, count * transform_size,
+        GL_MAP_WRITE_BIT | (dirty_range ? GL_MAP_INVALIDATE_RANGE_BIT
+                                        : GL_MAP_INVALIDATE_BUFFER_BIT));
+    if (job.target == NULL) {
+      debug_error("Failed to map the instance buffer for transforms");
+      return 0;
+    }
+  }
+
+  jobs_parallel_for(count, RENDERER_GL__MATRIX_JOB_GRAIN,
+                    renderer_gl__gather_transforms_job, &job);
+
+  if (job.target && batch->instance_stream == NULL) {
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+  }
+
+  // every path above leaves the whole buffer or region up to date
+  for (sc_list_size i = dirty_count; i-- > 0;) {
+    batch->dirty[batch->dirty_indices[i]] = 0;
+    sc_list_GLuint_remove_at(batch->dirty_indices, i);
+  }
+
+  renderer_gl__bind_vertex_array(batch->VAO);
+  renderer_gl__instance_transform_attributes(offset);
+
+  return dirty_range ? batch->count : count;
+}
+
+// storage bindings used by the culling compute shader
+#define RENDERER_GL__CULL_TRANSFORMS_BINDING (2)
+#define RENDERER_GL__CULL_MATRICES_BINDING (3)
+#define RENDERER_GL__CULL_COMMANDS_BINDING (4)
+#define RENDERER_GL__CULL_GROUP_SIZE (64)
+
+// the culling commands buffer holds the indirect command of the primitive at
+// [0..4] and a glDrawArraysIndirect command for RENDERER_GL_FLAG_DRAW_POINTS at
+// [5..8]. the shader counts visible instances into [1].
+#define RENDERER_GL__CULL_POINTS_COMMAND (5)
+
+// builds each instance matrix from its raw transform like mat4_from_trs, tests
+// its bounding sphere like frustum_cull_spheres and appends the matrices of
+// visible instances to u_matrices. u_transforms holds the streams of
+// renderer_gl_transforms back to back, u_count floats each.
+static const char *renderer_gl__cull_shader_source =
+    "#version 430\n"
+    "layout(local_size_x = 64) in;\n"
+    "layout(std430, binding = 2) readonly buffer transforms_block {\n"
+    "  float u_transforms[];\n"
+    "};\n"
+    "layout(std430, binding = 3) writeonly buffer matrices_block {\n"
+    "  mat4 u_matrices[];\n"
+    "};\n"
+    "layout(std430, binding = 4) buffer commands_block {\n"
+    "  uint u_commands[];\n"
+    "};\n"
+    "uniform uint u_count;\n"
+    "uniform vec4 u_planes[6];\n"
+    "uniform vec4 u_bounds;\n"
+    "void main() {\n"
+    "  uint i = gl_GlobalInvocationID.x;\n"
+    "  if (i >= u_count) {\n"
+    "    return;\n"
+    "  }\n"
+    "  vec3 p = vec3(u_transforms[i], u_transforms[u_count + i],\n"
+    "                u_transforms[2u * u_count + i]);\n"
+    "  vec4 q = vec4(u_transforms[3u * u_count + i],\n"
+    "                u_transforms[4u * u_count + i],\n"
+    "                u_transforms[5u * u_count + i],\n"
+    "                u_transforms[6u * u_count + i]);\n"
+    "  vec3 s = vec3(u_transforms[7u * u_count + i],\n"
+    "                u_transforms[8u * u_count + i],\n"
+    "                u_transforms[9u * u_count + i]);\n"
+    "  vec3 q2 = q.xyz * 2.0;\n"
+    "  float xx = q.x * q2.x, xy = q.x * q2.y, xz = q.x * q2.z;\n"
+    "  float yy = q.y * q2.y, yz = q.y * q2.z, zz = q.z * q2.z;\n"
+    "  float xw = q.w * q2.x, yw = q.w * q2.y, zw = q.w * q2.z;\n"
+    "  mat3 r = mat3(vec3(1.0 - (yy + zz), xy + zw, xz - yw) * s.x,\n"
+    "                vec3(xy - zw, 1.0 - (xx + zz), yz + xw) * s.y,\n"
+    "                vec3(xz + yw, yz - xw, 1.0 - (xx + yy)) * s.z);\n"
+    "  vec3 center = p + r * u_bounds.xyz;\n"
+    "  float radius = u_bounds.w * sqrt(max(max(dot(r[0], r[0]),\n"
+    "                                           dot(r[1], r[1])),\n"
+    "                                       dot(r[2], r[2])));\n"
+    "  for (int k = 0; k < 6; k++) {\n"
+    "    if (dot(u_planes[k].xyz, center) + u_planes[k].w + radius < 0.0) {\n"
+    "      return;\n"
+    "    }\n"
+    "  }\n"
+    "  uint slot = atomicAdd(u_commands[1], 1u);\n"
+    "  u_matrices[slot] = mat4(vec4(r[0], 0.0), vec4(r[1], 0.0),\n"
+    "                          vec4(r[2], 0.0), vec4(p, 1.0));\n"
+    "}\n";
+
+static struct {
+  GLuint program;
+  GLint count;
+  GLint planes;
+  GLint bounds;
+  int unavailable;
+} renderer_gl__gpu_cull = {0};
+
+// compiles the culling compute shader on first use. returns 0 when compute
+// shaders are not available, in which case batches fall back to the CPU.
+static int renderer_gl__gpu_cull_start(void) {
+  if (renderer_gl__gpu_cull.program) {
+    return 1;
+  }
+
+  if (renderer_gl__gpu_cull.unavailable) {
+    return 0;
+  }
+
+  if (!GLAD_GL_VERSION_4_3) {
+    debug_warn("GPU culling needs OpenGL 4.3, culling on the CPU instead");
+    renderer_gl__gpu_cull.unavailable = 1;
+    return 0;
+  }
+
+  GLuint shader = renderer_gl__shader_compile_source(
+      renderer_gl__cull_shader_source, GL_COMPUTE_SHADER, "culling");
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program, shader);
+  glLinkProgram(program);
+  glDetachShader(program, shader);
+  glDeleteShader(shader);
+
+  {
+    int success;
+    char infoLog[512];
+
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+
+    if (!success) {
+      glGetProgramInfoLog(program, 512, NULL, infoLog);
+      debug_error("failed to link shader : culling%s", infoLog);
+      debug_warn("culling on the CPU instead");
+      renderer_gl_shader_free(program);
+      renderer_gl__gpu_cull.unavailable = 1;
+      return 0;
+    }
+  }
+
+  renderer_gl__gpu_cull.program = program;
+  renderer_gl__gpu_cull.count = glGetUniformLocation(program, "u_count");
+  renderer_gl__gpu_cull.planes = glGetUniformLocation(program, "u_planes");
+  renderer_gl__gpu_cull.bounds = glGetUniformLocation(program, "u_bounds");
+  return 1;
+}
+
+// Uploads the raw transforms of batch and runs the culling shader over them.
+// Afterwards the culling matrix buffer holds the visible matrices and the
+// commands buffer their count, without any readback to the CPU.
+static void renderer_gl__gpu_cull_dispatch(renderer_gl_batch *batch) {
+  // the ten transform streams, batch->count floats each
+  const GLsizeiptr stream_size = batch->count * sizeof(GLfloat);
+  int upload_all = 0;
+
+  if (batch->gpu_culling == NULL) {
+    batch->gpu_culling = calloc(1, sizeof(*batch->gpu_culling));
+  }
+  renderer_gl_gpu_culling *culling = batch->gpu_culling;
+
+  if (culling->transform_buffer == 0) {
+    glGenBuffers(1, &culling->transform_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->transform_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, stream_size * 10, NULL,
+                 GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &culling->matrix_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->matrix_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 batch->count * sizeof(GLfloat) * 16, NULL, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &culling->command_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->command_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 9, NULL,
+                 GL_DYNAMIC_COPY);
+    upload_all = 1;
+  }
+
+  { // transforms, only the dirty range when tracking
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->transform_buffer);
+
+    const sc_list_size dirty_count = sc_list_GLuint_count(batch->dirty_indices);
+    GLuint first = 0;
+    GLuint last = batch->count - 1;
+    if (!upload_all &&
+        (batch->render_flags & RENDERER_GL_FLAG_USE_DIRTY_TRACKING)) {
+      first = batch->count;
+      last = 0;
+      for (sc_list_size i = 0; i < dirty_count; i++) {
+        const GLuint index = batch->dirty_indices[i];
+        first = index < first ? index : first;
+        last = index > last ? index : last;
+      }
+    }
+
+    for (int k = 0; k < 10 && first <= last; k++) {
+      glBufferSubData(GL_SHADER_STORAGE_BUFFER,
+                      k * stream_size + first * sizeof(GLfloat),
+                      (last - first + 1) * sizeof(GLfloat),
+                      renderer_gl__transform_stream(&batch->transforms, k) +
+                          first);
+    }
+
+    for (sc_list_size i = dirty_count; i-- > 0;) {
+      batch->dirty[batch->dirty_indices[i]] = 0;
+      sc_list_GLuint_remove_at(batch->dirty_indices, i);
+    }
+  }
+
+  { // reset the commands, the shader fills in the instance count
+    GLuint commands[9] = {0};
+    if (batch->primitive == RENDERER_GL_PRIMITIVE_TRIANGLES_INDEXED) {
+      commands[0] = sc_list_GLuint_count(batch->indices);
+    } else {
+      commands[0] = sc_list_renderer_gl_vertex_count(batch->vertices);
+    }
+    commands[RENDERER_GL__CULL_POINTS_COMMAND] =
+        sc_list_renderer_gl_vertex_count(batch->vertices);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling->command_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(commands), commands);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  }
+
+  renderer_gl__use_program(renderer_gl__gpu_cull.program);
+  glUniform1ui(renderer_gl__gpu_cull.count, batch->count);
+  glUniform4fv(renderer_gl__gpu_cull.planes, 6, &renderer_gl__cull.planes[0].x);
+  glUniform4f(renderer_gl__gpu_cull.bounds, batch->bounds_center.x,
+              batch->bounds_center.y, batch->bounds_center.z,
+              batch->bounds_radius);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER,
+                   RENDERER_GL__CULL_TRANSFORMS_BINDING,
+                   culling->transform_buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RENDERER_GL__CULL_MATRICES_BINDING,
+                   culling->matrix_buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RENDERER_GL__CULL_COMMANDS_BINDING,
+                   culling->command_buffer);
+
+  glDispatchCompute((batch->count + RENDERER_GL__CULL_GROUP_SIZE - 1) /
+                        RENDERER_GL__CULL_GROUP_SIZE,
+                    1, 1);
+
+  // the points command shares the instance count of the primitive command.
+  // the copy reads what the shader wrote, which GL_BUFFER_UPDATE_BARRIER_BIT
+  // covers, and the commands buffer is also an indirect source.
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT |
+                  GL_COMMAND_BARRIER_BIT);
+  glBindBuffer(GL_COPY_READ_BUFFER, culling->command_buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, culling->command_buffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                      sizeof(GLuint) * 1,
+                      sizeof(GLuint) * (RENDERER_GL__CULL_POINTS_COMMAND + 1),
+                      sizeof(GLuint));
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+// culls the instances of batch on the GPU and draws the survivors with one
+// indirect draw. program is the batch shader, restored after the dispatch.
+static void renderer_gl__draw_gpu_culled(const renderer_gl_batch *batch) {
+  // batches are never const objects, the draw path only promises not to change
+  // what callers see. the culling buffers are created on the first dispatch.
+  renderer_gl__gpu_cull_dispatch((renderer_gl_batch *)batch);
+  renderer_gl__use_program(batch->shader);
+
+  renderer_gl__bind_vertex_array(batch->VAO);
+  glBindBuffer(GL_ARRAY_BUFFER, batch->gpu_culling->matrix_buffer);
+  renderer_gl__instance_attributes(0);
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch->gpu_culling->command_buffer);
+
+  if (batch->render_flags & RENDERER_GL_FLAG_DRAW_POINTS) {
+    glDrawArraysIndirect(
+        GL_POINTS,
+        (void *)(sizeof(GLuint) * RENDERER_GL__CULL_POINTS_COMMAND));
+  }
+
+  renderer_gl__active_context->draw_calls++;
+
+  switch (batch->primitive) {
+  case RENDERER_GL_PRIMITIVE_LINES: {
+    glDrawArraysIndirect(GL_LINES, 0);
+  } break;
+
+  case RENDERER_GL_PRIMITIVE_POINTS: {
+    glDrawArraysIndirect(GL_POINTS, 0);
+  } break;
+
+  case RENDERER_GL_PRIMITIVE_TRIANGLES_INDEXED: {
+    glDrawElementsIndirect(GL_TRIANGLES, batch->index_type, 0);
+  } break;
+
+  case RENDERER_GL_PRIMITIVE_TRIANGLES: {
+    glDrawArraysIndirect(GL_TRIANGLES, 0);
+  } break;
+  }
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void renderer_gl_transform_matrix(GLfloat *matrix,
+                                  const renderer_gl_transform *transform) {
+  mat4_from_trs(matrix, transform->position, transform->rotation,
+                transform->scale);
+}
+
+// eye position of the last renderer_gl_camera_update, used for depth sorting
+static vector3 renderer_gl__camera_position = {0, 0, 0};
+
+void renderer_gl_camera_update(GLfloat *matrix,
+                               renderer_gl_transform transform) {
+  int width, height;
+  glfwGetFramebufferSize(renderer_gl__active_context->GLFWwindow, &width,
+                         &height);
+
+  const GLfloat aspect = (GLfloat)width / height;
+
+  GLfloat projection[16];
+  mat4_identity(projection);
+  renderer_gl_perspective(projection, RENDERER_GL__CAMERA_FOV, aspect, 0.0001,
+                          RENDERER_GL__CAMERA_FAR);
+
+  vector3 offset = vector3_rotate((vector3){0, 0, -1}, transform.rotation);
+
+  renderer_gl__camera_position = vector3_sub(transform.position, offset);
+  mat4_from_rt_inverse(matrix, renderer_gl__camera_position,
+                       transform.rotation);
+  mat4_multiply(renderer_gl__active_context->camera_matrix, matrix, projection);
+
+  frustum_from_mat4(renderer_gl__cull.planes,
+                    renderer_gl__active_context->camera_matrix);
+}
+
+void renderer_gl__uniform_materials(renderer_gl_batch batch,
+                                    const renderer_gl__uniforms *uniforms) {
+  { // textures
+    renderer_gl__bind_texture(0, batch.diffuse_map);
+    renderer_gl__bind_texture(1, batch.specular_map);
+  }
+
+  { // other material properties
+    glUniform1i(uniforms->material_diffuse, 0);
+    glUniform1i(uniforms->material_specular, 1);
+    glUniform1f(uniforms->material_shininess, 8.0f);
+
+    glUniform3f(uniforms->ambient_light, 0.2, 0.2, 0.2);
+
+    glUniform4f(uniforms->color, batch.color.x, batch.color.y, batch.color.z,
+                batch.color.w);
+  }
+}
+
+void renderer_gl__uniform_lights(renderer_gl_batch batch,
+                                 const renderer_gl__uniforms *uniforms) {
+  glUniform1ui(uniforms->lights_count, batch.lights_count);
+
+  for (GLuint light = 0;
+       light < batch.lights_count && light < uniforms->lights_capacity;
+       light++) {
+    const renderer_gl__light_locations *locations = &uniforms->lights[light];
+    const renderer_gl_light *l = &batch.lights[light];
+
+    glUniform1i(locations->type, l->type);
+    glUniform3f(locations->position, l->position.x, l->position.y,
+                l->position.z);
+    glUniform3f(locations->direction, l->direction.x, l->direction.y,
+                l->direction.z);
+    glUniform1f(locations->cut_off, l->cut_off);
+    glUniform1f(locations->outer_cut_off, l->outer_cut_off);
+    glUniform1f(locations->constant, l->constant);
+    glUniform1f(locations->linear, l->linear);
+    glUniform1f(locations->quadratic, l->quadratic);
+    glUniform3f(locations->diffuse, l->diffuse.x, l->diffuse.y, l->diffuse.z);
+    glUniform3f(locations->specular, l->specular.x, l->specular.y,
+                l->specular.z);
+  }
+}
+
+// std430 layout of one element of renderer_gl_lights_block.u_lights
+typedef struct {
+  GLfloat position[4];
+  GLfloat direction[4];
+  GLfloat diffuse[4];
+  GLfloat specular[4];
+  GLint type;
+  GLfloat cut_off;
+  GLfloat outer_cut_off;
+  GLfloat constant;
+  GLfloat linear;
+  GLfloat quadratic;
+  GLfloat padding[2];
+} renderer_gl__light_std430;
+
+// u_lights starts at the 16 byte alignment of the struct
+#define RENDERER_GL__LIGHTS_HEADER_SIZE (16)
+
+static struct {
+  GLuint buffer;
+  GLsizeiptr capacity;
+  // what the buffer currently holds
+  renderer_gl_light *lights;
+  GLuint lights_count;
+  // the array checked last and the frame it was checked in
+  const renderer_gl_light *checked;
+  long long checked_frame;
+} renderer_gl__lights = {0};
+
+// makes the shared light buffer hold the lights of batch. a batch pointing at
+// the array checked last in the same frame costs nothing, any other compares
+// its lights against the uploaded copy and uploads them if they differ.
+static void renderer_gl__lights_update(const renderer_gl_batch *batch) {
+  const long long frame = renderer_gl__active_context->frame_current;
+
+  if (renderer_gl__lights.buffer == 0) {
+    const unsigned char empty[RENDERER_GL__LIGHTS_HEADER_SIZE] = {0};
+    glGenBuffers(1, &renderer_gl__lights.buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer_gl__lights.buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(empty), empty,
+                 GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RENDERER_GL_LIGHTS_BINDING,
+                     renderer_gl__lights.buffer);
+    renderer_gl__lights.capacity = sizeof(empty);
+    renderer_gl__lights.checked_frame = -1;
+  }
+
+  if (renderer_gl__lights.checked == batch->lights &&
+      renderer_gl__lights.lights_count == batch->lights_count &&
+      renderer_gl__lights.checked_frame == frame) {
+    return;
+  }
+
+  renderer_gl__lights.checked = batch->lights;
+  renderer_gl__lights.checked_frame = frame;
+
+  const size_t lights_size = sizeof(*batch->lights) * batch->lights_count;
+  if (renderer_gl__lights.lights_count == batch->lights_count &&
+      (lights_size == 0 ||
+       memcmp(renderer_gl__lights.lights, batch->lights, lights_size) == 0)) {
+    return;
+  }
+
+  renderer_gl__lights.lights =
+      realloc(renderer_gl__lights.lights, lights_size + 1);
+  if (lights_size) {
+    memcpy(renderer_gl__lights.lights, batch->lights, lights_size);
+  }
+  renderer_gl__lights.lights_count = batch->lights_count;
+
+  const GLsizeiptr size = RENDERER_GL__LIGHTS_HEADER_SIZE +
+                          sizeof(renderer_gl__light_std430) *
+                              batch->lights_count;
+  unsigned char *data = calloc(size, 1);
+  *(GLuint *)data = batch->lights_count;
+
+  renderer_gl__light_std430 *packed =
+      (renderer_gl__light_std430 *)(data + RENDERER_GL__LIGHTS_HEADER_SIZE);
+  for (GLuint i = 0; i < batch->lights_count; i++) {
+    const renderer_gl_light *l = &batch->lights[i];
+    packed[i] = (renderer_gl__light_std430){
+        .position = {l->position.x, l->position.y, l->position.z, 0},
+        .direction = {l->direction.x, l->direction.y, l->direction.z, 0},
+        .diffuse = {l->diffuse.x, l->diffuse.y, l->diffuse.z, 0},
+        .specular = {l->specular.x, l->specular.y, l->specular.z, 0},
+        .type = l->type,
+        .cut_off = l->cut_off,
+        .outer_cut_off = l->outer_cut_off,
+        .constant = l->constant,
+        .linear = l->linear,
+        .quadratic = l->quadratic,
+    };
+  }
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer_gl__lights.buffer);
+  if (size > renderer_gl__lights.capacity) {
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_DRAW);
+    renderer_gl__lights.capacity = size;
+  } else {
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  free(data);
+}
+
+// tells the shader how to decode the vertices of mesh, see
+// renderer_gl_packed_vertex. NULL stands for the full floats of the pool.
+static void
+renderer_gl__uniform_vertex_format(const renderer_gl__uniforms *uniforms,
+                                   const renderer_gl_batch *mesh) {
+  if (mesh && mesh->packed) {
+    glUniform1i(uniforms->packed_vertices, 1);
+    glUniform3f(uniforms->position_offset, mesh->position_offset.x,
+                mesh->position_offset.y, mesh->position_offset.z);
+    glUniform3f(uniforms->position_scale, mesh->position_scale.x,
+                mesh->position_scale.y, mesh->position_scale.z);
+  } else {
+    glUniform1i(uniforms->packed_vertices, 0);
+    glUniform3f(uniforms->position_offset, 0.0f, 0.0f, 0.0f);
+    glUniform3f(uniforms->position_scale, 1.0f, 1.0f, 1.0f);
+  }
+}
+
+// draws instance_count instances of mesh as primitive from the bound vertex
+// array, plus its points with RENDERER_GL_FLAG_DRAW_POINTS in render_flags.
+static void renderer_gl__draw_mesh(const renderer_gl_batch *mesh,
+                                   const GLint render_flags,
+                                   const GLuint primitive,
+                                   const GLuint instance_count) {
+  const GLsizei vertex_count = sc_list_renderer_gl_vertex_count(mesh->vertices);
+
+  if (render_flags & RENDERER_GL_FLAG_DRAW_POINTS) {
+    glDrawArraysInstanced(GL_POINTS, 0, vertex_count, instance_count);
+  }
+
+  renderer_gl__active_context->draw_calls++;
+
+  switch (primitive) {
+  case RENDERER_GL_PRIMITIVE_LINES: {
+    glDrawArraysInstanced(GL_LINES, 0, vertex_count, instance_count);
+  } break;
+
+  case RENDERER_GL_PRIMITIVE_POINTS: {
+    glDrawArraysInstanced(GL_POINTS, 0, vertex_count, instance_count);
+  } break;
+
+  case RENDERER_GL_PRIMITIVE_TRIANGLES_INDEXED: {
+    glDrawElementsInstanced(GL_TRIANGLES, sc_list_GLuint_count(mesh->indices),
+                            mesh->index_type, 0, instance_count);
+  } break;
+
+  case RENDERER_GL_PRIMITIVE_TRIANGLES: {
+    glDrawArraysInstanced(GL_TRIANGLES, 0, vertex_count, instance_count);
+  } break;
+  }
+}
+
+// Levels of detail. The screen size of an instance is the radius of its world
+// bounding sphere over the half height of the view at its distance, so 1 when
+// it fills the screen vertically.
+#define RENDERER_GL__LOD_HYSTERESIS (0.15f)
+#define RENDERER_GL__LOD_ICOSPHERE_SIZE (0.5f)
+
+// coarsest level of batch whose threshold screen_size still reaches.
+static unsigned int renderer_gl__lod_level(const renderer_gl_batch *batch,
+                                           const GLfloat screen_size) {
+  unsigned int level = 0;
+  while (level < batch->lods_count &&
+         screen_size < batch->lod_screen_sizes[level]) {
+    level++;
+  }
+  return level;
+}
+
+// picks the level of one instance from its model matrix. an instance only
+// changes level once its size is past the threshold by the hysteresis margin.
+static unsigned int renderer_gl__lod_select(const renderer_gl_batch *batch,
+                                            const unsigned int instance,
+                                            const GLfloat *matrix) {
+  const vector4 s = renderer_gl__matrix_sphere(batch, matrix);
+  const GLfloat distance = vector3_distance(renderer_gl__camera_position,
+                                            (vector3){s.x, s.y, s.z});
+  const GLfloat screen_size =
+      distance > s.w ? s.w / (distance * tanf(RENDERER_GL__CAMERA_FOV / 2))
+                     : FLT_MAX;
+
+  unsigned int level = batch->lod_levels[instance];
+  const unsigned int finer = renderer_gl__lod_level(
+      batch, screen_size / (1 + RENDERER_GL__LOD_HYSTERESIS));
+  const unsigned int coarser = renderer_gl__lod_level(
+      batch, screen_size * (1 + RENDERER_GL__LOD_HYSTERESIS));
+  if (finer < level) {
+    level = finer;
+  } else if (coarser > level) {
+    level = coarser;
+  }
+
+  batch->lod_levels[instance] = level;
+  return level;
+}
+
+// the mesh drawn for level of batch
+static const renderer_gl_batch *
+renderer_gl__lod_mesh(const renderer_gl_batch *batch,
+                      const unsigned int level) {
+  return level == 0 ? batch : &batch->lods[level - 1];
+}
+
+static void renderer_gl__select_lods_job(void *user, size_t begin,
+                                         size_t end) {
+  const renderer_gl_batch *batch = user;
+  for (size_t i = begin; i < end; i++) {
+    const GLuint instance = renderer_gl__cull.visible[i];
+    renderer_gl__lod_select(batch, instance, batch->matrices + instance * 16);
+  }
+}
+
+// Draws the instances of a batch with levels of detail. The visible instances
+// are bucketed by level, each bucket packed into its own range of the matrix
+// buffer and drawn with the vertex array of its level.
+static void
+renderer_gl__draw_instanced_lods(const renderer_gl_batch *batch,
+                                 const renderer_gl__uniforms *uniforms) {
+  renderer_gl__update_matrices(batch);
+
+  GLuint count;
+  if (batch->render_flags &
+      (RENDERER_GL_FLAG_USE_CULLING | RENDERER_GL_FLAG_USE_GPU_CULLING)) {
+    count = renderer_gl__cull_matrices(batch, batch->matrices, batch->count);
+  } else {
+    renderer_gl__cull_reserve(batch->count);
+    for (GLuint i = 0; i < batch->count; i++) {
+      renderer_gl__cull.visible[i] = i;
+    }
+    count = batch->count;
+  }
+
+  jobs_parallel_for(count, RENDERER_GL__MATRIX_JOB_GRAIN,
+                    renderer_gl__select_lods_job, (void *)batch);
+
+  GLuint firsts[RENDERER_GL_LODS_MAX + 1] = {0};
+  GLuint counts[RENDERER_GL_LODS_MAX + 1] = {0};
+  for (GLuint i = 0; i < count; i++) {
+    counts[batch->lod_levels[renderer_gl__cull.visible[i]]]++;
+  }
+  for (unsigned int level = 1; level <= batch->lods_count; level++) {
+    firsts[level] = firsts[level - 1] + counts[level - 1];
+  }
+
+  GLintptr offset = 0;
+  glBindBuffer(GL_ARRAY_BUFFER, batch->model_matrix_buffer);
+
+  GLfloat *target;
+  if (batch->instance_stream) {
+    target = renderer_gl__stream_acquire(batch, &offset);
+  } else {
+    target = glMapBufferRange(GL_ARRAY_BUFFER, 0,
+                              batch->count * sizeof(GLfloat) * 16,
+                              GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (target == NULL) {
+      debug_error("Failed to map the instance buffer for levels of detail");
+      return;
+    }
+  }
+
+  GLuint cursors[RENDERER_GL_LODS_MAX + 1];
+  memcpy(cursors, firsts, sizeof(cursors));
+  for (GLuint i = 0; i < count; i++) {
+    const GLuint instance = renderer_gl__cull.visible[i];
+    memcpy(target + cursors[batch->lod_levels[instance]]++ * 16,
+           batch->matrices + instance * 16, sizeof(GLfloat) * 16);
+  }
+
+  if (batch->instance_stream == NULL) {
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+  }
+
+  for (unsigned int level = 0; level <= batch->lods_count; level++) {
+    if (counts[level] == 0) {
+      continue;
+    }
+
+    const renderer_gl_batch *mesh = renderer_gl__lod_mesh(batch, level);
+    renderer_gl__uniform_vertex_format(uniforms, mesh);
+    renderer_gl__bind_vertex_array(mesh->VAO);
+    renderer_gl__instance_attributes(offset +
+                                     firsts[level] * sizeof(GLfloat) * 16);
+    renderer_gl__draw_mesh(mesh, batch->render_flags, batch->primitive,
+                           counts[level]);
+  }
+
+  if (batch->instance_stream) { // guard the region we just drew from
+    renderer_gl__stream_release(batch);
+  }
+}
+
+void renderer_gl__draw(const renderer_gl_batch *batch,
+                       const renderer_gl__uniforms *uniforms) {
+  glUniform1i(uniforms->use_instancing, 0);
+  glUniform1i(uniforms->use_multi_draw, 0);
+  glUniform1i(uniforms->use_instance_transforms, 0);
+
+  const renderer_gl_transform transform =
+      renderer_gl_transforms_get(&batch->transforms, 0);
+  renderer_gl_transform_matrix(batch->matrices, &transform);
+  glUniformMatrix4fv(uniforms->model_matrix, 1, GL_FALSE, batch->matrices);
+
+  const renderer_gl_batch *mesh = batch;
+  if (batch->lods_count) {
+    mesh = renderer_gl__lod_mesh(
+        batch, renderer_gl__lod_select(batch, 0, batch->matrices));
+  }
 
-  glBindVertexArray(0);
+  renderer_gl__uniform_vertex_format(uniforms, mesh);
+  renderer_gl__bind_vertex_array(mesh->VAO);
+  renderer_gl__draw_mesh(mesh, batch->render_flags, batch->primitive, 1);
 }
 
-void renderer_gl_transform_matrix(GLfloat *matrix,
-                                  const renderer_gl_transform *transform) {
-  { // Model
+void renderer_gl__draw_instanced(const renderer_gl_batch *batch,
+                                 const renderer_gl__uniforms *uniforms) {
+  glUniform1i(uniforms->use_instancing, 1);
+  glUniform1i(uniforms->use_multi_draw, 0);
+
+  // levels of detail and GPU culling keep drawing from matrices
+  const int use_transforms =
+      (batch->render_flags & RENDERER_GL_FLAG_USE_INSTANCE_TRANSFORMS) &&
+      batch->lods_count == 0 &&
+      !((batch->render_flags & RENDERER_GL_FLAG_USE_GPU_CULLING) &&
+        renderer_gl__gpu_cull_start());
+  glUniform1i(uniforms->use_instance_transforms, use_transforms);
+
+  if (batch->lods_count) {
+    renderer_gl__draw_instanced_lods(batch, uniforms);
+    return;
+  }
 
-    mat4_identity(matrix);
+  renderer_gl__uniform_vertex_format(uniforms, batch);
 
-    {
-      GLfloat scale[16];
-      mat4_identity(scale);
-      scale[0] = transform[0].scale.x;
-      scale[5] = transform[0].scale.y;
-      scale[10] = transform[0].scale.z;
+  if ((batch->render_flags & RENDERER_GL_FLAG_USE_GPU_CULLING) &&
+      renderer_gl__gpu_cull_start()) {
+    renderer_gl__draw_gpu_culled(batch);
+    return;
+  }
 
-      GLfloat translation[16];
-      mat4_identity(translation);
-      translation[12] = transform[0].position.x;
-      translation[13] = transform[0].position.y;
-      translation[14] = transform[0].position.z;
+  const GLuint instance_count = use_transforms
+                                    ? renderer_gl__buffer_transforms(batch)
+                                    : renderer_gl__buffer_matrices(batch);
+  if (instance_count == 0) {
+    return;
+  }
 
-      GLfloat rotation[16] = {0};
-      quaternion_to_mat4(transform[0].rotation, rotation);
+  renderer_gl__bind_vertex_array(batch->VAO);
+  renderer_gl__draw_mesh(batch, batch->render_flags, batch->primitive,
+                         instance_count);
 
-      mat4_multiply(matrix, scale, rotation);
-      mat4_multiply(matrix, matrix, translation);
-    }
+  if (batch->instance_stream) { // guard the region we just drew from
+    renderer_gl__stream_release(batch);
   }
 }
 
-void renderer_gl_camera_update(GLfloat *matrix,
-                               renderer_gl_transform transform) {
-  int width, height;
-  glfwGetFramebufferSize(renderer_gl__active_context->GLFWwindow, &width,
-                         &height);
+typedef struct {
+  uint64_t key;
+  const renderer_gl_batch *batch;
+} renderer_gl__queue_entry;
+
+static struct {
+  renderer_gl__queue_entry *entries;
+  renderer_gl__queue_entry *scratch;
+  size_t count;
+  size_t capacity;
+} renderer_gl__queue = {0};
+
+// applies the render flags, program, materials, lights and camera of batch.
+// returns the index of the uniform locations of its program.
+static sc_list_size renderer_gl__draw_setup(const renderer_gl_batch *batch) {
+  { // render flags
+    if (batch->render_flags & RENDERER_GL_FLAG_USE_WIREFRAME) {
+      renderer_gl__polygon_mode(GL_LINE);
+    } else {
+      renderer_gl__polygon_mode(GL_FILL);
+    }
 
-  const GLfloat aspect = (GLfloat)width / height;
+    if (batch->render_flags & RENDERER_GL_FLAG_USE_STENCIL) {
+      renderer_gl__stencil_mask(0xFF);
+    } else {
+      renderer_gl__stencil_mask(0x00);
+    }
+  }
 
-  GLfloat projection[16];
-  mat4_identity(projection);
-  renderer_gl_perspective(projection, 70 * (3.14159 / 180.0), aspect, 0.0001,
-                          1000);
+  renderer_gl__use_program(batch->shader);
 
-  vector3 offset = vector3_rotate((vector3){0, 0, -1}, transform.rotation);
+  const sc_list_size index = renderer_gl__uniforms_get(batch->shader);
+  const renderer_gl__uniforms *uniforms = &renderer_gl__uniforms_cache[index];
 
-  GLfloat translation_matrix[16];
-  mat4_identity(translation_matrix);
-  translation_matrix[12] = -transform.position.x + offset.x;
-  translation_matrix[13] = -transform.position.y + offset.y;
-  translation_matrix[14] = -transform.position.z + offset.z;
+  renderer_gl__uniform_materials(*batch, uniforms);
+  if (uniforms->lights_block) {
+    renderer_gl__lights_update(batch);
+  } else {
+    renderer_gl__uniform_lights(*batch, uniforms);
+  }
 
-  GLfloat rotation_matrix[16];
-  mat4_identity(rotation_matrix);
-  quaternion_to_mat4(quaternion_conjugate(transform.rotation), rotation_matrix);
+  glUniformMatrix4fv(uniforms->camera_matrix, 1, GL_FALSE,
+                     renderer_gl__active_context->camera_matrix);
 
-  mat4_multiply(matrix, translation_matrix, rotation_matrix);
-  mat4_multiply(renderer_gl__active_context->camera_matrix, matrix, projection);
+  return index;
 }
 
-void renderer_gl__uniform_materials(renderer_gl_batch batch) {
-  { // textures
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, batch.diffuse_map);
+static void renderer_gl__draw_batch(const renderer_gl_batch *batch) {
+  const renderer_gl__uniforms *uniforms =
+      &renderer_gl__uniforms_cache[renderer_gl__draw_setup(batch)];
+
+  if (batch->render_flags & RENDERER_GL_FLAG_USE_INSTANCING) {
+    renderer_gl__draw_instanced(batch, uniforms);
+  } else {
+    renderer_gl__draw(batch, uniforms);
+  }
+}
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, batch.specular_map);
+void renderer_gl_draw(const renderer_gl_batch *batch) {
+  if ((batch->render_flags & RENDERER_GL_FLAG_ENABLED) == 0 ||
+      !renderer_gl__visible(batch)) {
+    return;
   }
 
-  { // other material properties
-    glUniform1i(glGetUniformLocation(batch.shader, "u_material.diffuse"), 0);
-    glUniform1i(glGetUniformLocation(batch.shader, "u_material.specular"), 1);
-    glUniform1f(glGetUniformLocation(batch.shader, "u_material.shininess"),
-                8.0f);
+  renderer_gl__draw_batch(batch);
+}
 
-    glUniform3f(glGetUniformLocation(batch.shader, "u_ambient_light"), 0.2, 0.2,
-                0.2);
+typedef struct {
+  GLuint offset;
+  GLuint size;
+} renderer_gl__range;
+SC_LIST(renderer_gl__range)
+
+// first fit allocator for ranges of a growable buffer. freed ranges are merged
+// with their neighbours, or given back to the end of the buffer.
+typedef struct {
+  sc_list_renderer_gl__range free_ranges;
+  GLuint used;
+} renderer_gl__range_allocator;
+
+static GLuint renderer_gl__range_alloc(renderer_gl__range_allocator *allocator,
+                                       const GLuint size) {
+  if (allocator->free_ranges == NULL) {
+    allocator->free_ranges = sc_list_renderer_gl__range_alloc();
+  }
 
-    glUniform4f(glGetUniformLocation(batch.shader, "u_color"), batch.color.x,
-                batch.color.y, batch.color.z, batch.color.w);
+  sc_foreach(i, sc_list_renderer_gl__range_count(allocator->free_ranges)) {
+    renderer_gl__range *range = &allocator->free_ranges[i];
+    if (range->size >= size) {
+      const GLuint offset = range->offset;
+      range->offset += size;
+      range->size -= size;
+      if (range->size == 0) {
+        sc_list_renderer_gl__range_remove_at(allocator->free_ranges, i);
+      }
+      return offset;
+    }
   }
+
+  const GLuint offset = allocator->used;
+  allocator->used += size;
+  return offset;
 }
 
-void renderer_gl__uniform_lights(renderer_gl_batch batch) {
+static void renderer_gl__range_free(renderer_gl__range_allocator *allocator,
+                                    GLuint offset, GLuint size) {
+  for (sc_list_size i =
+           sc_list_renderer_gl__range_count(allocator->free_ranges);
+       i-- > 0;) {
+    const renderer_gl__range range = allocator->free_ranges[i];
+    if (range.offset + range.size == offset) {
+      offset = range.offset;
+      size += range.size;
+      sc_list_renderer_gl__range_remove_at(allocator->free_ranges, i);
+    } else if (offset + size == range.offset) {
+      size += range.size;
+      sc_list_renderer_gl__range_remove_at(allocator->free_ranges, i);
+    }
+  }
 
-  for (GLuint light = 0; light < batch.lights_count; light++) {
-    glUniform1ui(glGetUniformLocation(batch.shader, "u_lights_count"),
-                 batch.lights_count);
-    {
-      char uniform_name[64] = {0};
+  if (offset + size == allocator->used) {
+    allocator->used = offset;
+  } else {
+    sc_list_renderer_gl__range_add(&allocator->free_ranges,
+                                   (renderer_gl__range){offset, size});
+  }
+}
 
-      snprintf(uniform_name, sizeof(uniform_name), "u_lights[%d].type", light);
+// layout of the DrawElementsIndirectCommand consumed by
+// glMultiDrawElementsIndirect
+typedef struct {
+  GLuint count;
+  GLuint instance_count;
+  GLuint first_index;
+  GLint base_vertex;
+  GLuint base_instance;
+} renderer_gl__draw_command;
+
+// std430 layout of one element of renderer_gl_draws_block.u_draws
+typedef struct {
+  GLfloat model_matrix[16];
+  GLfloat color[4];
+} renderer_gl__draw_data;
+
+// one vertex and one index buffer shared by every pooled batch, so batches
+// with the same state can be drawn by a single multi draw call.
+static struct {
+  GLuint VAO;
+  GLuint VBO;
+  GLuint EBO;
+  GLuint vertex_capacity;
+  GLuint index_capacity;
+  renderer_gl__range_allocator vertices;
+  renderer_gl__range_allocator indices;
+
+  GLuint command_buffer;
+  GLuint draw_buffer;
+  renderer_gl__draw_command *commands;
+  renderer_gl__draw_data *draws;
+  size_t draws_capacity;
+} renderer_gl__pool = {0};
+
+// returns a buffer of new_size holding the first old_size bytes of buffer.
+static GLuint renderer_gl__buffer_grow(GLuint buffer, GLsizeiptr old_size,
+                                      GLsizeiptr new_size) {
+  GLuint grown;
+  glGenBuffers(1, &grown);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+  glBufferData(GL_COPY_WRITE_BUFFER, new_size, NULL, GL_STATIC_DRAW);
+
+  if (buffer) {
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        old_size);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    renderer_gl__delete_buffer(&buffer);
+  }
 
-      glUniform1i(glGetUniformLocation(batch.shader, uniform_name),
-                  batch.lights[light].type);
-    }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return grown;
+}
 
-    {
-      char uniform_name[64] = {0};
+static void renderer_gl__pool_reserve(void) {
+  const GLuint vertex_capacity = renderer_gl__pool.vertex_capacity;
+  const GLuint index_capacity = renderer_gl__pool.index_capacity;
 
-      snprintf(uniform_name, sizeof(uniform_name), "u_lights[%d].position",
-               light);
+  if (renderer_gl__pool.VAO == 0) {
+    glGenVertexArrays(1, &renderer_gl__pool.VAO);
+    glGenBuffers(1, &renderer_gl__pool.command_buffer);
+    glGenBuffers(1, &renderer_gl__pool.draw_buffer);
+  }
 
-      glUniform3f(glGetUniformLocation(batch.shader, uniform_name),
-                  batch.lights[light].position.x,
-                  batch.lights[light].position.y,
-                  batch.lights[light].position.z);
+  if (renderer_gl__pool.vertices.used > vertex_capacity) {
+    GLuint capacity = vertex_capacity * 2 + 4096;
+    while (capacity < renderer_gl__pool.vertices.used) {
+      capacity *= 2;
     }
-    {
-      char uniform_name[64] = {0};
-
-      snprintf(uniform_name, sizeof(uniform_name), "u_lights[%d].direction",
-               light);
+    renderer_gl__pool.VBO = renderer_gl__buffer_grow(
+        renderer_gl__pool.VBO, vertex_capacity * sizeof(renderer_gl_vertex),
+        capacity * sizeof(renderer_gl_vertex));
+    renderer_gl__pool.vertex_capacity = capacity;
+
+    renderer_gl__bind_vertex_array(renderer_gl__pool.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, renderer_gl__pool.VBO);
+    renderer_gl__vertex_attributes(0);
+  }
 
-      glUniform3f(glGetUniformLocation(batch.shader, uniform_name),
-                  batch.lights[light].direction.x,
-                  batch.lights[light].direction.y,
-                  batch.lights[light].direction.z);
+  if (renderer_gl__pool.indices.used > index_capacity) {
+    GLuint capacity = index_capacity * 2 + 4096;
+    while (capacity < renderer_gl__pool.indices.used) {
+      capacity *= 2;
     }
-    {
-      char uniform_name[64] = {0};
+    renderer_gl__pool.EBO = renderer_gl__buffer_grow(
+        renderer_gl__pool.EBO, index_capacity * sizeof(GLuint),
+        capacity * sizeof(GLuint));
+    renderer_gl__pool.index_capacity = capacity;
 
-      snprintf(uniform_name, sizeof(uniform_name), "u_lights[%d].cut_off",
-               light);
+    renderer_gl__bind_vertex_array(renderer_gl__pool.VAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer_gl__pool.EBO);
+  }
+}
 
-      glUniform1f(glGetUniformLocation(batch.shader, uniform_name),
-                  batch.lights[light].cut_off);
-    }
-    {
-      char uniform_name[64] = {0};
+void renderer_gl_batch_pool(renderer_gl_batch *batch) {
+  if (batch->pooled) {
+    return;
+  }
 
-      snprintf(uniform_name, sizeof(uniform_name), "u_lights[%d].outer_cut_off",
-               light);
+  renderer_gl_mesh *mesh = batch->mesh;
+  if (mesh && mesh->pooled) {
+    batch->pool_base_vertex = mesh->pool_base_vertex;
+    batch->pool_vertex_count = mesh->pool_vertex_count;
+    batch->pool_first_index = mesh->pool_first_index;
+    batch->pool_index_count = mesh->pool_index_count;
+    batch->pooled = 1;
+    return;
+  }
 
-      glUniform1f(glGetUniformLocation(batch.shader, uniform_name),
-                  batch.lights[light].outer_cut_off);
-    }
-    {
-      char uniform_name[64] = {0};
+  if (batch->primitive != RENDERER_GL_PRIMITIVE_TRIANGLES &&
+      batch->primitive != RENDERER_GL_PRIMITIVE_TRIANGLES_INDEXED) {
+    debug_warn("Only triangle batches can be pooled");
+    return;
+  }
 
-      snprintf(uniform_name, sizeof(uniform_name), "u_lights[%d].constant",
-               light);
+  const GLuint vertex_count = sc_list_renderer_gl_vertex_count(batch->vertices);
 
-      glUniform1f(glGetUniformLocation(batch.shader, uniform_name),
-                  batch.lights[light].constant);
+  // non indexed triangles are pooled with an identity index list
+  sc_list_GLuint indices = batch->indices;
+  if (batch->primitive == RENDERER_GL_PRIMITIVE_TRIANGLES) {
+    indices = sc_list_GLuint_alloc();
+    for (GLuint i = 0; i < vertex_count; i++) {
+      sc_list_GLuint_add(&indices, i);
     }
-    {
-      char uniform_name[64] = {0};
-
-      snprintf(uniform_name, sizeof(uniform_name), "u_lights[%d].linear",
-               light);
+  }
+  const GLuint index_count = sc_list_GLuint_count(indices);
+
+  batch->pool_base_vertex =
+      renderer_gl__range_alloc(&renderer_gl__pool.vertices, vertex_count);
+  batch->pool_vertex_count = vertex_count;
+  batch->pool_first_index =
+      renderer_gl__range_alloc(&renderer_gl__pool.indices, index_count);
+  batch->pool_index_count = index_count;
+  batch->pooled = 1;
+
+  renderer_gl__pool_reserve();
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, renderer_gl__pool.VBO);
+  glBufferSubData(GL_COPY_WRITE_BUFFER,
+                  batch->pool_base_vertex * sizeof(renderer_gl_vertex),
+                  vertex_count * sizeof(renderer_gl_vertex), batch->vertices);
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, renderer_gl__pool.EBO);
+  glBufferSubData(GL_COPY_WRITE_BUFFER,
+                  batch->pool_first_index * sizeof(GLuint),
+                  index_count * sizeof(GLuint), indices);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  if (indices != batch->indices) {
+    sc_list_GLuint_free(indices);
+  }
 
-      glUniform1f(glGetUniformLocation(batch.shader, uniform_name),
-                  batch.lights[light].linear);
-    }
-    {
-      char uniform_name[64] = {0};
+  if (mesh) {
+    mesh->pool_base_vertex = batch->pool_base_vertex;
+    mesh->pool_vertex_count = vertex_count;
+    mesh->pool_first_index = batch->pool_first_index;
+    mesh->pool_index_count = index_count;
+    mesh->pooled = 1;
+  }
+}
 
-      snprintf(uniform_name, sizeof(uniform_name), "u_lights[%d].quadratic",
-               light);
+// drops a reference to mesh, freeing its geometry after the last one.
+static void renderer_gl__mesh_release(renderer_gl_mesh *mesh) {
+  if (--mesh->references > 0) {
+    return;
+  }
 
-      glUniform1f(glGetUniformLocation(batch.shader, uniform_name),
-                  batch.lights[light].quadratic);
+  for (size_t i = 0; i < renderer_gl__meshes.count; i++) {
+    if (renderer_gl__meshes.meshes[i] == mesh) {
+      renderer_gl__meshes.meshes[i] =
+          renderer_gl__meshes.meshes[--renderer_gl__meshes.count];
+      break;
     }
-    {
-      char uniform_name[64] = {0};
+  }
 
-      snprintf(uniform_name, sizeof(uniform_name), "u_lights[%d].diffuse",
-               light);
+  if (renderer_gl__meshes.count == 0) {
+    free(renderer_gl__meshes.meshes);
+    renderer_gl__meshes.meshes = NULL;
+    renderer_gl__meshes.capacity = 0;
+  }
 
-      glUniform3f(glGetUniformLocation(batch.shader, uniform_name),
-                  batch.lights[light].diffuse.x, batch.lights[light].diffuse.y,
-                  batch.lights[light].diffuse.z);
-    }
-    {
-      char uniform_name[64] = {0};
+  if (mesh->vertices) {
+    sc_list_renderer_gl_vertex_free(mesh->vertices);
+  }
+  if (mesh->indices) {
+    sc_list_GLuint_free(mesh->indices);
+  }
+  if (mesh->pooled) {
+    renderer_gl__range_free(&renderer_gl__pool.vertices, mesh->pool_base_vertex,
+                            mesh->pool_vertex_count);
+    renderer_gl__range_free(&renderer_gl__pool.indices, mesh->pool_first_index,
+                            mesh->pool_index_count);
+  }
+  renderer_gl__delete_buffer(&mesh->VBO);
+  renderer_gl__delete_buffer(&mesh->EBO);
+  free(mesh->path);
+  free(mesh);
+}
 
-      snprintf(uniform_name, sizeof(uniform_name), "u_lights[%d].specular",
-               light);
+static GLshort renderer_gl__snorm16(const GLfloat value) {
+  return (GLshort)lrintf(mathf_clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
 
-      glUniform3f(glGetUniformLocation(batch.shader, uniform_name),
-                  batch.lights[light].specular.x,
-                  batch.lights[light].specular.y,
-                  batch.lights[light].specular.z);
-    }
+static GLfloat renderer_gl__snorm16_decode(const GLshort value) {
+  return mathf_max(value / 32767.0f, -1.0f);
+}
+
+// projects the unit vector n onto the octahedron |x| + |y| + |z| = 1 and
+// folds the lower half over the upper one, into the unit square.
+static void renderer_gl__octahedral_encode(const vector3 n, GLshort out[2]) {
+  const GLfloat length = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+  GLfloat x = length > 0.0f ? n.x / length : 0.0f;
+  GLfloat y = length > 0.0f ? n.y / length : 0.0f;
+  if (n.z < 0.0f) {
+    const GLfloat folded = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = folded;
   }
+  out[0] = renderer_gl__snorm16(x);
+  out[1] = renderer_gl__snorm16(y);
 }
 
-void renderer_gl__draw(const renderer_gl_batch *batch) {
-  glUniform1i(glGetUniformLocation(batch->shader, "u_use_instancing"), 0);
+// the decoding of the shader in renderer_gl_packed_vertex
+static vector3 renderer_gl__octahedral_decode(const GLshort in[2]) {
+  vector3 n = {renderer_gl__snorm16_decode(in[0]),
+               renderer_gl__snorm16_decode(in[1]), 0.0f};
+  n.z = 1.0f - fabsf(n.x) - fabsf(n.y);
+  const GLfloat t = mathf_max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  vector3_normalize(&n);
+  return n;
+}
 
-  renderer_gl_transform_matrix(batch->matrices, batch->transform);
+// packs count vertices relative to their bounding box, whose decoding goes to
+// offset and scale. logs the largest errors of the decoded vertices.
+static void renderer_gl__pack(const renderer_gl_vertex *vertices,
+                              const GLuint count,
+                              renderer_gl_packed_vertex *packed,
+                              vector3 *offset, vector3 *scale) {
+  vector3 min = vertices[0].position;
+  vector3 max = vertices[0].position;
+  for (GLuint i = 1; i < count; i++) {
+    min = vector3_min(min, vertices[i].position);
+    max = vector3_max(max, vertices[i].position);
+  }
+  *offset = vector3_scaled(vector3_add(min, max), 0.5f);
+  *scale = vector3_scaled(vector3_sub(max, min), 0.5f);
+  // flat meshes still need something to divide by
+  scale->x = scale->x > 0.0f ? scale->x : 1.0f;
+  scale->y = scale->y > 0.0f ? scale->y : 1.0f;
+  scale->z = scale->z > 0.0f ? scale->z : 1.0f;
+
+  GLfloat position_error = 0.0f;
+  GLfloat normal_error = 0.0f;
+  GLfloat texture_error = 0.0f;
+  GLuint clamped = 0;
+  for (GLuint i = 0; i < count; i++) {
+    const renderer_gl_vertex *v = &vertices[i];
+    renderer_gl_packed_vertex *p = &packed[i];
+
+    const vector3 relative = vector3_sub(v->position, *offset);
+    p->position[0] = renderer_gl__snorm16(relative.x / scale->x);
+    p->position[1] = renderer_gl__snorm16(relative.y / scale->y);
+    p->position[2] = renderer_gl__snorm16(relative.z / scale->z);
+    p->position[3] = 0;
+    const vector3 position = {
+        offset->x + renderer_gl__snorm16_decode(p->position[0]) * scale->x,
+        offset->y + renderer_gl__snorm16_decode(p->position[1]) * scale->y,
+        offset->z + renderer_gl__snorm16_decode(p->position[2]) * scale->z,
+    };
+    position_error = mathf_max(position_error,
+                               vector3_distance(position, v->position));
+
+    renderer_gl__octahedral_encode(v->normal, p->normal);
+    if (vector3_magnitude(v->normal) > 0.0f) {
+      vector3 normal = v->normal;
+      vector3_normalize(&normal);
+      const GLfloat cosine = vector3_dot(
+          normal, renderer_gl__octahedral_decode(p->normal));
+      normal_error =
+          mathf_max(normal_error, acosf(mathf_clamp(cosine, -1.0f, 1.0f)));
+    }
 
-  {
-    GLint model_matrix_location =
-        glGetUniformLocation(batch->shader, "u_model_matrix");
-    glUniformMatrix4fv(model_matrix_location, 1, GL_FALSE, batch->matrices);
+    const GLfloat uv[2] = {v->texture_coordinates.x,
+                           v->texture_coordinates.y};
+    for (int k = 0; k < 2; k++) {
+      clamped += uv[k] < 0.0f || uv[k] > 1.0f;
+      p->texture_coordinates[k] =
+          (GLushort)lrintf(mathf_clamp01(uv[k]) * 65535.0f);
+      if (uv[k] >= 0.0f && uv[k] <= 1.0f) {
+        texture_error = mathf_max(
+            texture_error,
+            fabsf(p->texture_coordinates[k] / 65535.0f - uv[k]));
+      }
+    }
   }
 
-  glBindVertexArray(batch->VAO);
+  debug_log("Packed %u vertices: position error %g, normal error %g degrees, "
+            "texture coordinate error %g",
+            count, position_error, mathf_rad2deg(normal_error),
+            texture_error);
+  if (clamped) {
+    debug_warn("Clamped %u packed texture coordinates to [0, 1]", clamped);
+  }
+}
 
-  if (batch->render_flags & RENDERER_GL_FLAG_DRAW_POINTS) {
-    glDrawArrays(GL_POINTS, 0,
-                 sc_list_renderer_gl_vertex_count(batch->vertices));
+// packs the geometry of batch into new buffers behind a new vertex array.
+static void renderer_gl__buffer_packed(renderer_gl_batch *batch) {
+  const GLuint vertex_count = sc_list_renderer_gl_vertex_count(batch->vertices);
+  renderer_gl_packed_vertex *packed = malloc(sizeof(*packed) * vertex_count);
+  renderer_gl__pack(batch->vertices, vertex_count, packed,
+                    &batch->position_offset, &batch->position_scale);
+
+  if (batch->primitive == RENDERER_GL_PRIMITIVE_TRIANGLES_INDEXED) {
+    renderer_gl__buffer_elements(&batch->VAO, &batch->VBO, &batch->EBO,
+                                 &batch->index_type, vertex_count, packed, 1,
+                                 sc_list_GLuint_count(batch->indices),
+                                 batch->indices);
+  } else {
+    renderer_gl__buffer_vertices(&batch->VAO, &batch->VBO, vertex_count,
+                                 packed, 1);
+    batch->EBO = 0;
   }
+  batch->packed = 1;
 
-  renderer_gl__active_context->draw_calls++;
+  free(packed);
+}
 
-  switch (batch->primitive) {
-  case RENDERER_GL_PRIMITIVE_LINES: {
-    glDrawArrays(GL_LINES, 0,
-                 sc_list_renderer_gl_vertex_count(batch->vertices));
-  } break;
+void renderer_gl_batch_pack_vertices(renderer_gl_batch *batch) {
+  for (unsigned int i = 0; i < batch->lods_count; i++) {
+    renderer_gl_batch_pack_vertices(&batch->lods[i]);
+  }
 
-  case RENDERER_GL_PRIMITIVE_POINTS: {
-    glDrawArrays(GL_POINTS, 0,
-                 sc_list_renderer_gl_vertex_count(batch->vertices));
-  } break;
+  if (batch->packed || batch->vertices == NULL ||
+      sc_list_renderer_gl_vertex_count(batch->vertices) == 0) {
+    return;
+  }
+  if (batch->pooled) {
+    debug_warn("Pack batches before pooling them");
+    return;
+  }
 
-  case RENDERER_GL_PRIMITIVE_TRIANGLES_INDEXED: {
-    glDrawElements(GL_TRIANGLES, sc_list_GLuint_count(batch->indices),
-                   GL_UNSIGNED_INT, 0);
-  } break;
+  renderer_gl__delete_vertex_array(&batch->VAO);
 
-  case RENDERER_GL_PRIMITIVE_TRIANGLES: {
-    glDrawArrays(GL_TRIANGLES, 0,
-                 sc_list_renderer_gl_vertex_count(batch->vertices));
-  } break;
+  renderer_gl_mesh *mesh = batch->mesh;
+  if (mesh == NULL) {
+    renderer_gl__delete_buffer(&batch->VBO);
+    renderer_gl__delete_buffer(&batch->EBO);
+    renderer_gl__buffer_packed(batch);
+    return;
+  }
+
+  // the packed mesh is cached beside the full float one, with its own copy of
+  // the geometry
+  renderer_gl_mesh *packed = renderer_gl__mesh_find(
+      mesh->archetype, mesh->subdivisions, mesh->path, 1);
+  if (packed) {
+    packed->references++;
+  } else {
+    renderer_gl_batch geometry = *batch;
+    geometry.vertices = sc_list_renderer_gl_vertex_alloc_from_array(
+        batch->vertices, sc_list_renderer_gl_vertex_count(batch->vertices));
+    geometry.indices =
+        batch->indices ? sc_list_GLuint_alloc_from_array(
+                             batch->indices,
+                             sc_list_GLuint_count(batch->indices))
+                       : NULL;
+    renderer_gl__buffer_packed(&geometry);
+    renderer_gl__delete_vertex_array(&geometry.VAO);
+    renderer_gl__mesh_insert(&geometry, mesh->archetype, mesh->subdivisions,
+                             mesh->path);
+    packed = geometry.mesh;
   }
+
+  renderer_gl__mesh_release(mesh);
+  renderer_gl__mesh_attach(batch, packed);
+}
+
+static int renderer_gl__can_multi_draw(const renderer_gl_batch *batch) {
+  return batch->pooled && batch->lods_count == 0 &&
+         (batch->render_flags & (RENDERER_GL_FLAG_USE_INSTANCING |
+                                 RENDERER_GL_FLAG_DRAW_POINTS)) == 0 &&
+         renderer_gl__uniforms_cache[renderer_gl__uniforms_get(batch->shader)]
+             .draws_block;
 }
 
-void renderer_gl__draw_instanced(const renderer_gl_batch *batch) {
-  glUniform1i(glGetUniformLocation(batch->shader, "u_use_instancing"), 1);
+// true if b can share a multi draw with a. everything that is not per draw
+// data has to match.
+static int renderer_gl__same_state(const renderer_gl_batch *a,
+                                   const renderer_gl_batch *b) {
+  return a->shader == b->shader && a->diffuse_map == b->diffuse_map &&
+         a->specular_map == b->specular_map &&
+         a->render_flags == b->render_flags && a->lights == b->lights &&
+         a->lights_count == b->lights_count;
+}
 
-  renderer_gl__buffer_matrices(batch);
+// draws count compatible pooled batches with one glMultiDrawElementsIndirect.
+static void renderer_gl__draw_multi(const renderer_gl__queue_entry *entries,
+                                    const size_t count) {
+  const renderer_gl__uniforms *uniforms =
+      &renderer_gl__uniforms_cache[renderer_gl__draw_setup(entries[0].batch)];
+
+  if (count > renderer_gl__pool.draws_capacity) {
+    renderer_gl__pool.draws_capacity = count * 2;
+    renderer_gl__pool.commands =
+        realloc(renderer_gl__pool.commands,
+                sizeof(*renderer_gl__pool.commands) *
+                    renderer_gl__pool.draws_capacity);
+    renderer_gl__pool.draws = realloc(renderer_gl__pool.draws,
+                                      sizeof(*renderer_gl__pool.draws) *
+                                          renderer_gl__pool.draws_capacity);
+  }
 
-  glBindVertexArray(batch->VAO);
+  for (size_t i = 0; i < count; i++) {
+    const renderer_gl_batch *batch = entries[i].batch;
 
-  if (batch->render_flags & RENDERER_GL_FLAG_DRAW_POINTS) {
-    glDrawArraysInstanced(GL_POINTS, 0,
-                          sc_list_renderer_gl_vertex_count(batch->vertices),
-                          batch->count);
+    renderer_gl__pool.commands[i] = (renderer_gl__draw_command){
+        .count = batch->pool_index_count,
+        .instance_count = 1,
+        .first_index = batch->pool_first_index,
+        .base_vertex = batch->pool_base_vertex,
+        .base_instance = 0,
+    };
+
+    renderer_gl__draw_data *draw = &renderer_gl__pool.draws[i];
+    const renderer_gl_transform transform =
+        renderer_gl_transforms_get(&batch->transforms, 0);
+    renderer_gl_transform_matrix(draw->model_matrix, &transform);
+    draw->color[0] = batch->color.x;
+    draw->color[1] = batch->color.y;
+    draw->color[2] = batch->color.z;
+    draw->color[3] = batch->color.w;
   }
 
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer_gl__pool.draw_buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               sizeof(*renderer_gl__pool.draws) * count,
+               renderer_gl__pool.draws, GL_STREAM_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RENDERER_GL_DRAWS_BINDING,
+                   renderer_gl__pool.draw_buffer);
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, renderer_gl__pool.command_buffer);
+  glBufferData(GL_DRAW_INDIRECT_BUFFER,
+               sizeof(*renderer_gl__pool.commands) * count,
+               renderer_gl__pool.commands, GL_STREAM_DRAW);
+
+  glUniform1i(uniforms->use_instancing, 0);
+  glUniform1i(uniforms->use_multi_draw, 1);
+  glUniform1i(uniforms->use_instance_transforms, 0);
+  renderer_gl__uniform_vertex_format(uniforms, NULL);
+
+  renderer_gl__bind_vertex_array(renderer_gl__pool.VAO);
+  glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, count, 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
   renderer_gl__active_context->draw_calls++;
+}
 
-  switch (batch->primitive) {
-  case RENDERER_GL_PRIMITIVE_LINES: {
-    glDrawArraysInstanced(GL_LINES, 0,
-                          sc_list_renderer_gl_vertex_count(batch->vertices),
-                          batch->count);
-  } break;
+void renderer_gl_submit(const renderer_gl_batch *batch) {
+  if ((batch->render_flags & RENDERER_GL_FLAG_ENABLED) == 0) {
+    return;
+  }
 
-  case RENDERER_GL_PRIMITIVE_POINTS: {
-    glDrawArraysInstanced(GL_POINTS, 0,
-                          sc_list_renderer_gl_vertex_count(batch->vertices),
-                          batch->count);
-  } break;
+  if (renderer_gl__queue.count == renderer_gl__queue.capacity) {
+    renderer_gl__queue.capacity = renderer_gl__queue.capacity * 2 + 64;
+    renderer_gl__queue.entries =
+        realloc(renderer_gl__queue.entries,
+                sizeof(*renderer_gl__queue.entries) *
+                    renderer_gl__queue.capacity);
+    renderer_gl__queue.scratch =
+        realloc(renderer_gl__queue.scratch,
+                sizeof(*renderer_gl__queue.scratch) *
+                    renderer_gl__queue.capacity);
+  }
 
-  case RENDERER_GL_PRIMITIVE_TRIANGLES_INDEXED: {
-    glDrawElementsInstanced(GL_TRIANGLES, sc_list_GLuint_count(batch->indices),
-                            GL_UNSIGNED_INT, 0, batch->count);
-  } break;
+  renderer_gl__queue.entries[renderer_gl__queue.count++] =
+      (renderer_gl__queue_entry){.key = 0, .batch = batch};
+}
 
-  case RENDERER_GL_PRIMITIVE_TRIANGLES: {
-    glDrawArraysInstanced(GL_TRIANGLES, 0,
-                          sc_list_renderer_gl_vertex_count(batch->vertices),
-                          batch->count);
-  } break;
+// Opaque batches sort by state, then front to back within equal state:
+//   [63] 0 | [62..51] shader | [50..41] diffuse | [40..31] specular |
+//   [30..24] flags | [23..0] depth
+// Transparent batches sort after all opaque ones, back to front:
+//   [63] 1 | [62..39] inverted depth | [38..27] shader | [26..17] diffuse |
+//   [16..7] specular | [6..0] flags
+// GL names are truncated to their low bits. That only affects how well equal
+// state clusters, never correctness.
+static uint64_t renderer_gl__sort_key(const renderer_gl_batch *batch) {
+  const vector3 position = {batch->transforms.position[0][0],
+                            batch->transforms.position[1][0],
+                            batch->transforms.position[2][0]};
+  const GLfloat distance =
+      vector3_distance(renderer_gl__camera_position, position);
+  const uint64_t depth =
+      (uint64_t)(mathf_clamp01(distance / RENDERER_GL__CAMERA_FAR) * 0xFFFFFF);
+
+  const uint64_t shader = batch->shader & 0xFFF;
+  const uint64_t diffuse = batch->diffuse_map & 0x3FF;
+  const uint64_t specular = batch->specular_map & 0x3FF;
+  const uint64_t flags = (batch->render_flags >> 1) & 0x7F;
+
+  if (batch->render_flags & RENDERER_GL_FLAG_USE_TRANSPARENCY) {
+    return (1ull << 63) | ((0xFFFFFF - depth) << 39) | (shader << 27) |
+           (diffuse << 17) | (specular << 7) | flags;
   }
+
+  return (shader << 51) | (diffuse << 41) | (specular << 31) | (flags << 24) |
+         depth;
 }
 
-void renderer_gl_draw(const renderer_gl_batch *batch) {
+// LSD radix sort on the 64 bit keys, one byte per pass. passes where every key
+// has the same byte are skipped, so the usual handful of shaders and textures
+// costs far fewer than 8 passes.
+static void renderer_gl__queue_sort(void) {
+  const size_t count = renderer_gl__queue.count;
+  renderer_gl__queue_entry *from = renderer_gl__queue.entries;
+  renderer_gl__queue_entry *to = renderer_gl__queue.scratch;
+
+  for (unsigned int shift = 0; shift < 64; shift += 8) {
+    size_t offsets[256] = {0};
+    for (size_t i = 0; i < count; i++) {
+      offsets[(from[i].key >> shift) & 0xFF]++;
+    }
 
-  { // render flags
-    if ((batch->render_flags & RENDERER_GL_FLAG_ENABLED) == 0) {
-      return;
+    if (offsets[(from[0].key >> shift) & 0xFF] == count) {
+      continue;
     }
 
-    if (batch->render_flags & RENDERER_GL_FLAG_USE_WIREFRAME) {
-      glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    } else {
-      glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    size_t sum = 0;
+    for (unsigned int b = 0; b < 256; b++) {
+      const size_t n = offsets[b];
+      offsets[b] = sum;
+      sum += n;
     }
 
-    if (batch->render_flags & RENDERER_GL_FLAG_USE_STENCIL) {
-      glStencilMask(0xFF);
-    } else {
-      glStencilMask(0x00);
+    for (size_t i = 0; i < count; i++) {
+      to[offsets[(from[i].key >> shift) & 0xFF]++] = from[i];
     }
+
+    renderer_gl__queue_entry *swap = from;
+    from = to;
+    to = swap;
   }
 
-  glUseProgram(batch->shader);
+  renderer_gl__queue.entries = from;
+  renderer_gl__queue.scratch = to;
+}
 
-  renderer_gl__uniform_materials(*batch);
-  renderer_gl__uniform_lights(*batch);
+void renderer_gl_flush(void) {
+  if (renderer_gl__queue.count == 0) {
+    return;
+  }
 
-  {
-    GLint camera_matrix_location =
-        glGetUniformLocation(batch->shader, "u_camera_matrix");
-    glUniformMatrix4fv(camera_matrix_location, 1, GL_FALSE,
-                       renderer_gl__active_context->camera_matrix);
+  // drop culled batches before sorting so they never split a multi draw
+  size_t count = 0;
+  for (size_t i = 0; i < renderer_gl__queue.count; i++) {
+    const renderer_gl_batch *batch = renderer_gl__queue.entries[i].batch;
+    if (renderer_gl__visible(batch)) {
+      renderer_gl__queue.entries[count++] = (renderer_gl__queue_entry){
+          .key = renderer_gl__sort_key(batch),
+          .batch = batch,
+      };
+    }
   }
+  renderer_gl__queue.count = count;
+
+  renderer_gl__queue_sort();
+
+  // consecutive pooled batches sharing state become one multi draw
+  const renderer_gl__queue_entry *entries = renderer_gl__queue.entries;
+  for (size_t i = 0; i < renderer_gl__queue.count;) {
+    size_t run = 1;
+    if (renderer_gl__can_multi_draw(entries[i].batch)) {
+      while (i + run < renderer_gl__queue.count &&
+             renderer_gl__can_multi_draw(entries[i + run].batch) &&
+             renderer_gl__same_state(entries[i].batch,
+                                     entries[i + run].batch)) {
+        run++;
+      }
+    }
 
-  if (batch->render_flags & RENDERER_GL_FLAG_USE_INSTANCING) {
-    renderer_gl__draw_instanced(batch);
-  } else {
-    renderer_gl__draw(batch);
+    if (run > 1) {
+      renderer_gl__draw_multi(entries + i, run);
+    } else {
+      renderer_gl__draw_batch(entries[i].batch);
+    }
+    i += run;
   }
 
-  glUseProgram(0);
+  renderer_gl__queue.count = 0;
 }
 
 renderer_gl_batch renderer_gl_batch_alloc(const unsigned int count,
@@ -542,22 +3158,36 @@ renderer_gl_batch renderer_gl_batch_alloc(const unsigned int count,
 
   if (count > 1) {
     glGenBuffers(1, &batch.model_matrix_buffer);
+    batch.instance_stream =
+        renderer_gl__instance_stream_alloc(batch.model_matrix_buffer, count);
+
+    if (batch.instance_stream == NULL) {
+      glBindBuffer(GL_ARRAY_BUFFER, batch.model_matrix_buffer);
+      glBufferData(GL_ARRAY_BUFFER, count * sizeof(GLfloat) * 16, NULL,
+                   GL_DYNAMIC_DRAW);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
   }
 
-  batch.transform = calloc(sizeof(*batch.transform), count);
+  batch.transforms = renderer_gl_transforms_alloc(count);
+
+  // every instance starts out dirty so the first upload fills every region.
+  batch.dirty = malloc(sizeof(*batch.dirty) * count);
+  memset(batch.dirty, RENDERER_GL__DIRTY_ALL, sizeof(*batch.dirty) * count);
+  batch.dirty_indices = sc_list_GLuint_alloc();
   for (unsigned int i = 0; i < count; i++) {
-    renderer_gl_transform t = (renderer_gl_transform){
-        .position = (vector3){0, 0, 0},
-        .rotation = (vector4){0, 0, 0, 1},
-        .scale = (vector3){1, 1, 1},
-    };
-    batch.transform[i] = t;
+    sc_list_GLuint_add(&batch.dirty_indices, i);
   }
 
   batch.matrices = calloc(sizeof(*batch.matrices) * 16, count),
 
   batch.render_flags = RENDERER_GL_FLAG_ENABLED;
   batch.primitive = RENDERER_GL_PRIMITIVE_TRIANGLES;
+  batch.index_type = GL_UNSIGNED_INT;
+
+  if (renderer_gl__mesh_acquire(&batch, archetype, 0, NULL)) {
+    return batch;
+  }
 
   switch (archetype) {
   case RENDERER_GL_ARCHETYPE_QUAD: {
@@ -687,6 +3317,11 @@ renderer_gl_batch renderer_gl_batch_alloc(const unsigned int count,
   } break;
   }
 
+  renderer_gl_batch_bounds_update(&batch);
+  if (batch.vertices) {
+    renderer_gl__mesh_insert(&batch, archetype, 0, NULL);
+  }
+
   return batch;
 }
 
@@ -703,10 +3338,76 @@ void renderer_gl_lines_alloc(renderer_gl_batch *batch, sc_list_vector3 points) {
   renderer_gl__buffer_vertex_array(
       &batch->VAO, &batch->VBO,
       sc_list_renderer_gl_vertex_count(batch->vertices), batch->vertices);
+
+  renderer_gl_batch_bounds_update(batch);
+}
+
+// open addressing table from an edge, keyed by its two vertex indices, to
+// the vertex at its middle.
+typedef struct {
+  uint64_t *keys;
+  GLuint *values;
+  size_t mask;
+} renderer_gl__edge_map;
+
+#define RENDERER_GL__EDGE_NONE (UINT64_MAX)
+
+static renderer_gl__edge_map renderer_gl__edge_map_alloc(const size_t count) {
+  size_t capacity = 64;
+  while (capacity < count * 2) { // keep the load under half
+    capacity *= 2;
+  }
+
+  return (renderer_gl__edge_map){
+      .keys = malloc(sizeof(uint64_t) * capacity),
+      .values = malloc(sizeof(GLuint) * capacity),
+      .mask = capacity - 1,
+  };
+}
+
+static void renderer_gl__edge_map_free(renderer_gl__edge_map *map) {
+  free(map->keys);
+  free(map->values);
+}
+
+static void renderer_gl__edge_map_clear(renderer_gl__edge_map *map) {
+  memset(map->keys, 0xFF, sizeof(uint64_t) * (map->mask + 1));
+}
+
+// index of the vertex halfway between a and b on the unit sphere, added to
+// vertices the first time the edge is seen.
+static GLuint
+renderer_gl__icosphere_midpoint(renderer_gl__edge_map *edges,
+                                sc_list_renderer_gl_vertex *vertices,
+                                const GLuint a, const GLuint b) {
+  const uint64_t key = a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a;
+  size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & edges->mask;
+  while (edges->keys[slot] != RENDERER_GL__EDGE_NONE) {
+    if (edges->keys[slot] == key) {
+      return edges->values[slot];
+    }
+    slot = (slot + 1) & edges->mask;
+  }
+
+  vector3 position =
+      vector3_lerp((*vertices)[a].position, (*vertices)[b].position, 0.5);
+  vector3_normalize(&position);
+
+  const GLuint index = sc_list_renderer_gl_vertex_count(*vertices);
+  sc_list_renderer_gl_vertex_add(
+      vertices, (renderer_gl_vertex){.position = position, .normal = position});
+
+  edges->keys[slot] = key;
+  edges->values[slot] = index;
+  return index;
 }
 
 void renderer_gl_icosphere_mesh_alloc(renderer_gl_batch *batch,
                                       const unsigned int subdivisions) {
+  if (renderer_gl__mesh_acquire(batch, RENDERER_GL__MESH_ICOSPHERE,
+                                subdivisions, NULL)) {
+    return;
+  }
 
   const GLfloat t = (1.0 + sqrt(5.0)) / 2.0;
 
@@ -744,12 +3445,25 @@ void renderer_gl_icosphere_mesh_alloc(renderer_gl_batch *batch,
     }
   }
 
-  for (unsigned int i = 0;
-       i < sc_list_renderer_gl_vertex_count(batch->vertices); i++) {
+  for (unsigned int i = 0; i < 12; i++) {
     vector3_normalize(&batch->vertices[i].position);
     batch->vertices[i].normal = batch->vertices[i].position;
   }
 
+  // every pass splits each triangle in 4 and each edge in 2
+  sc_list_size triangles = 20;
+  for (unsigned int subd = 0; subd < subdivisions; subd++) {
+    triangles *= 4;
+  }
+  sc_list_renderer_gl_vertex_reserve(&batch->vertices, triangles / 2 + 2);
+
+  sc_list_GLuint_reserve(&batch->indices, triangles * 3);
+
+  // sized for the edges of the last pass
+  renderer_gl__edge_map edges = renderer_gl__edge_map_alloc(triangles * 3 / 8);
+  sc_list_GLuint new_indices = sc_list_GLuint_alloc();
+  sc_list_GLuint_reserve(&new_indices, triangles * 3);
+
   // *===============================================*
   // * vertex layout                                 *
   // *===============================================*
@@ -770,62 +3484,38 @@ void renderer_gl_icosphere_mesh_alloc(renderer_gl_batch *batch,
   // *===============================================*
 
   for (unsigned int subd = 0; subd < subdivisions; subd++) {
-    sc_list_GLuint new_indices = sc_list_GLuint_alloc();
+    renderer_gl__edge_map_clear(&edges);
+    sc_list_GLuint_clear(new_indices);
+
     for (unsigned int tri = 0; tri < sc_list_GLuint_count(batch->indices);
          tri += 3) {
       const unsigned int i1 = batch->indices[tri];
       const unsigned int i2 = batch->indices[tri + 1];
       const unsigned int i3 = batch->indices[tri + 2];
-      { // get vertices in this triangle
-        const renderer_gl_vertex v1 = batch->vertices[i1];
-        const renderer_gl_vertex v2 = batch->vertices[i2];
-        const renderer_gl_vertex v3 = batch->vertices[i3];
-        // create middle vertices
-        const renderer_gl_vertex m1 = (renderer_gl_vertex){
-            .position = vector3_lerp(v1.position, v2.position, 0.5)};
-        const renderer_gl_vertex m2 = (renderer_gl_vertex){
-            .position = vector3_lerp(v2.position, v3.position, 0.5)};
-        const renderer_gl_vertex m3 = (renderer_gl_vertex){
-            .position = vector3_lerp(v3.position, v1.position, 0.5)};
-        sc_list_renderer_gl_vertex_add(&batch->vertices, m1);
-        sc_list_renderer_gl_vertex_add(&batch->vertices, m2);
-        sc_list_renderer_gl_vertex_add(&batch->vertices, m3);
-      }
-      { // get new indices
-        const unsigned int i4 =
-            sc_list_renderer_gl_vertex_count(batch->vertices) - 3;
-        const unsigned int i5 =
-            sc_list_renderer_gl_vertex_count(batch->vertices) - 2;
-        const unsigned int i6 =
-            sc_list_renderer_gl_vertex_count(batch->vertices) - 1;
-
-        sc_list_GLuint_add(&new_indices, i4);
-        sc_list_GLuint_add(&new_indices, i5);
-        sc_list_GLuint_add(&new_indices, i6);
-
-        sc_list_GLuint_add(&new_indices, i1);
-        sc_list_GLuint_add(&new_indices, i4);
-        sc_list_GLuint_add(&new_indices, i6);
-
-        sc_list_GLuint_add(&new_indices, i4);
-        sc_list_GLuint_add(&new_indices, i2);
-        sc_list_GLuint_add(&new_indices, i5);
-
-        sc_list_GLuint_add(&new_indices, i6);
-        sc_list_GLuint_add(&new_indices, i5);
-        sc_list_GLuint_add(&new_indices, i3);
+      // neighbours share the middle vertices of their common edges
+      const unsigned int i4 =
+          renderer_gl__icosphere_midpoint(&edges, &batch->vertices, i1, i2);
+      const unsigned int i5 =
+          renderer_gl__icosphere_midpoint(&edges, &batch->vertices, i2, i3);
+      const unsigned int i6 =
+          renderer_gl__icosphere_midpoint(&edges, &batch->vertices, i3, i1);
+
+      const GLuint split[12] = {
+          i4, i5, i6, i1, i4, i6, i4, i2, i5, i6, i5, i3,
+      };
+      for (unsigned int i = 0; i < 12; i++) {
+        sc_list_GLuint_add(&new_indices, split[i]);
       }
     }
-    sc_list_GLuint_free(batch->indices);
-    batch->indices = new_indices;
 
-    for (unsigned int i = 0;
-         i < sc_list_renderer_gl_vertex_count(batch->vertices); i++) {
-      vector3_normalize(&batch->vertices[i].position);
-      batch->vertices[i].normal = batch->vertices[i].position;
-    }
+    sc_list_GLuint swap = batch->indices;
+    batch->indices = new_indices;
+    new_indices = swap;
   }
 
+  sc_list_GLuint_free(new_indices);
+  renderer_gl__edge_map_free(&edges);
+
 #if 0
   debug_log("final lists ------------------------------------");
   for (unsigned int g = 0; g < sc_list_renderer_gl_vertex_count(batch->vertices); g++) {
@@ -842,102 +3532,234 @@ void renderer_gl_icosphere_mesh_alloc(renderer_gl_batch *batch,
   putchar('\n');
 #endif
 
+  char name[32];
+  snprintf(name, sizeof(name), "icosphere %u", subdivisions);
+  // convex, nothing to gain from the overdraw order
+  renderer_gl__mesh_optimize(batch, 0, name);
+
   renderer_gl__buffer_element_array(
-      &batch->VAO, &batch->VBO, &batch->EBO,
+      &batch->VAO, &batch->VBO, &batch->EBO, &batch->index_type,
       sc_list_renderer_gl_vertex_count(batch->vertices), batch->vertices,
       sc_list_GLuint_count(batch->indices), batch->indices);
+
+  renderer_gl_batch_bounds_update(batch);
+  renderer_gl__mesh_insert(batch, RENDERER_GL__MESH_ICOSPHERE, subdivisions,
+                           NULL);
 }
 
-void renderer_gl_mesh_obj_alloc(renderer_gl_batch *batch,
-                                const char *filepath) {
-  file_buffer file = file_buffer_alloc(filepath);
+void renderer_gl_batch_lod_add(renderer_gl_batch *batch,
+                               renderer_gl_batch mesh,
+                               const GLfloat screen_size) {
+  if (batch->lods_count == RENDERER_GL_LODS_MAX) {
+    debug_warn("Batch already has %d levels of detail", RENDERER_GL_LODS_MAX);
+    renderer_gl_batch_free(mesh);
+    return;
+  }
+  assert(batch->lods_count == 0 ||
+         screen_size < batch->lod_screen_sizes[batch->lods_count - 1]);
+
+  if (batch->lod_levels == NULL) {
+    batch->lod_levels = calloc(sizeof(*batch->lod_levels), batch->count);
+  }
+
+  batch->lods = realloc(batch->lods, sizeof(*batch->lods) *
+                                         (batch->lods_count + 1));
+  batch->lods[batch->lods_count] = mesh;
+  batch->lod_screen_sizes[batch->lods_count] = screen_size;
+  batch->lods_count++;
+}
 
+void renderer_gl_icosphere_lods_alloc(renderer_gl_batch *batch,
+                                      const unsigned int subdivisions) {
+  renderer_gl_icosphere_mesh_alloc(batch, subdivisions);
+
+  for (unsigned int level = 1;
+       level <= subdivisions && level <= RENDERER_GL_LODS_MAX; level++) {
+    renderer_gl_batch mesh =
+        renderer_gl_batch_alloc(1, RENDERER_GL_ARCHETYPE_EMPTY);
+    renderer_gl_icosphere_mesh_alloc(&mesh, subdivisions - level);
+    // every level has a quarter of the triangles of the finer one, so halving
+    // the size keeps about the same triangle density on screen.
+    renderer_gl_batch_lod_add(batch, mesh,
+                              RENDERER_GL__LOD_ICOSPHERE_SIZE /
+                                  (GLfloat)(1u << (level - 1)));
+  }
+}
+
+// fills batch from a mapped mesh file. the GPU buffers are filled straight
+// from the mapping, the batch keeps its own copies for the CPU side.
+static void renderer_gl__mesh_file_load(renderer_gl_batch *batch,
+                                        const mesh_file *file) {
   batch->primitive = RENDERER_GL_PRIMITIVE_TRIANGLES_INDEXED;
+  batch->index_type =
+      file->index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+  renderer_gl__buffer_indexed(&batch->VAO, &batch->VBO, &batch->EBO,
+                              file->vertex_count, file->vertices, 0,
+                              file->index_count, batch->index_type,
+                              file->indices);
+
+  // sized once and filled straight from the mapping
   batch->vertices = sc_list_renderer_gl_vertex_alloc();
-  batch->indices = sc_list_GLuint_alloc();
+  sc_list_renderer_gl_vertex_resize(&batch->vertices, file->vertex_count);
+  memcpy(batch->vertices, file->vertices,
+         sizeof(renderer_gl_vertex) * file->vertex_count);
 
-  sc_list_vector3 positions = sc_list_vector3_alloc();
-  sc_list_vector2 texcoords = sc_list_vector2_alloc();
-
-  for (const char *c = file.text; c < file.text + file.length; c++) {
-    // printf("%c", *c);
-    if ((*c) == 'v') {
-      if (c[1] == 't') {
-        vector2 t = {0};
-        sscanf(c, "vt%f%f", &t.x, &t.y);
-        // debug_log("vt[%lu] { %f %f }", sc_list_vector2_count(texcoords), t.x,
-        // t.y);
-        sc_list_vector2_add(&texcoords, t);
-      } else if (c[1] == 'n') {
-      } else {
-        vector3 v = {0};
-        sscanf(c, "v%f%f%f", &v.x, &v.y, &v.z);
-        // debug_log("v[%lu] { %f %f %f }", sc_list_vector3_count(positions),
-        // v.x, v.y, v.z);
-        sc_list_vector3_add(&positions, v);
-      }
+  batch->indices = sc_list_GLuint_alloc();
+  sc_list_GLuint_resize(&batch->indices, file->index_count);
+  if (file->index_size == 2) {
+    const uint16_t *indices = file->indices;
+    for (uint32_t i = 0; i < file->index_count; i++) {
+      batch->indices[i] = indices[i];
     }
+  } else {
+    memcpy(batch->indices, file->indices, sizeof(GLuint) * file->index_count);
+  }
 
-    if ((*c) == 'f') {
-      unsigned int position_indices[3] = {0, 0, 0};
-      unsigned int normal_indices[3] = {0, 0, 0};
-      unsigned int texture_indices[3] = {0, 0, 0};
-
-      // clang-format off
-      const int got = sscanf(c, "f %u/%u/%u %u/%u/%u %u/%u/%u",
-        &position_indices[2],
-        &normal_indices[2],
-        &texture_indices[2],
-        &position_indices[1],
-        &normal_indices[1],
-        &texture_indices[1],
-        &position_indices[0],
-        &normal_indices[0],
-        &texture_indices[0]);
-      // clang-format on
-
-      if (got != 9) {
-        debug_error("OOPS!");
-      }
+  batch->bounds_center = (vector3){
+      file->bounds_center[0], file->bounds_center[1], file->bounds_center[2]};
+  batch->bounds_radius = file->bounds_radius;
+}
 
-      for (unsigned int i = 0; i < 3; i++) {
-        sc_list_GLuint_add(&batch->indices, position_indices[i] - 1);
-      }
-    }
+void renderer_gl_mesh_obj_alloc(renderer_gl_batch *batch,
+                                const char *filepath) {
+  if (renderer_gl__mesh_acquire(batch, RENDERER_GL__MESH_OBJ, 0, filepath)) {
+    return;
   }
 
-  file_buffer_free(file);
+  // the binary mesh file written by an earlier load
+  const size_t filepath_length = strlen(filepath);
+  char *cache_path = malloc(filepath_length + sizeof(RENDERER_GL__MESH_FILE));
+  memcpy(cache_path, filepath, filepath_length);
+  memcpy(cache_path + filepath_length, RENDERER_GL__MESH_FILE,
+         sizeof(RENDERER_GL__MESH_FILE));
+
+  mesh_file cached;
+  if (mesh_file_open(&cached, cache_path, filepath,
+                     sizeof(renderer_gl_vertex))) {
+    renderer_gl__mesh_file_load(batch, &cached);
+    mesh_file_close(&cached);
+    free(cache_path);
+    renderer_gl__mesh_insert(batch, RENDERER_GL__MESH_OBJ, 0, filepath);
+    return;
+  }
+
+  file_buffer file = file_buffer_alloc(filepath);
+  if (file.error) {
+    debug_error("Failed to open %s", filepath);
+  }
+
+  batch->primitive = RENDERER_GL_PRIMITIVE_TRIANGLES_INDEXED;
+  batch->vertices = sc_list_renderer_gl_vertex_alloc();
+  batch->indices = sc_list_GLuint_alloc();
 
-  for (unsigned int i = 0; i < sc_list_vector3_count(positions); i++) {
+  obj_mesh mesh = file.error ? obj_parse("", 0)
+                             : obj_parse(file.text, file.length);
+  obj_smooth_normals(&mesh);
+
+  // one vertex per distinct position, texcoord and normal
+  const sc_list_size corner_count = sc_list_obj_corner_count(mesh.corners);
+  GLuint *corner_vertices = malloc(sizeof(*corner_vertices) * corner_count);
+  sc_list_obj_corner unique = obj_weld(&mesh, corner_vertices);
+
+  sc_list_GLuint_reserve(&batch->indices, corner_count);
+  for (sc_list_size i = 0; i < corner_count; i += 3) {
+    // triangles are stored with the opposite winding of the file
+    sc_list_GLuint_add(&batch->indices, corner_vertices[i + 2]);
+    sc_list_GLuint_add(&batch->indices, corner_vertices[i + 1]);
+    sc_list_GLuint_add(&batch->indices, corner_vertices[i]);
+  }
+
+  const sc_list_size vertex_count = sc_list_obj_corner_count(unique);
+  sc_list_renderer_gl_vertex_reserve(&batch->vertices, vertex_count);
+  for (sc_list_size i = 0; i < vertex_count; i++) {
+    const obj_corner corner = unique[i];
     renderer_gl_vertex v = {0};
-    v.position = positions[i];
+    v.position = mesh.positions[corner.position];
+    v.normal = mesh.normals[corner.normal];
+    if (corner.texcoord != OBJ_NONE) {
+      v.texture_coordinates = mesh.texcoords[corner.texcoord];
+    }
     sc_list_renderer_gl_vertex_add(&batch->vertices, v);
   }
 
-  sc_list_vector3_free(positions);
-  sc_list_vector2_free(texcoords);
+  free(corner_vertices);
+  sc_list_obj_corner_free(unique);
+  obj_free(&mesh);
+
+  renderer_gl__mesh_optimize(batch, 1, filepath);
 
   renderer_gl__buffer_element_array(
-      &batch->VAO, &batch->VBO, &batch->EBO,
+      &batch->VAO, &batch->VBO, &batch->EBO, &batch->index_type,
       sc_list_renderer_gl_vertex_count(batch->vertices), batch->vertices,
       sc_list_GLuint_count(batch->indices), batch->indices);
+
+  renderer_gl_batch_bounds_update(batch);
+
+  // a file that failed to open leaves the batch empty and its own, so a later
+  // load of the same path tries the file again
+  if (!file.error) {
+    renderer_gl__mesh_insert(batch, RENDERER_GL__MESH_OBJ, 0, filepath);
+
+    const mesh_file written = {
+        .vertex_count = sc_list_renderer_gl_vertex_count(batch->vertices),
+        .vertex_size = sizeof(renderer_gl_vertex),
+        .index_count = sc_list_GLuint_count(batch->indices),
+        .index_size = sizeof(GLuint),
+        .bounds_center = {batch->bounds_center.x, batch->bounds_center.y,
+                          batch->bounds_center.z},
+        .bounds_radius = batch->bounds_radius,
+        .vertices = batch->vertices,
+        .indices = batch->indices,
+    };
+    mesh_file_write(cache_path, filepath, file.text, file.length, &written);
+  }
+
+  file_buffer_free(file);
+  free(cache_path);
 }
 
 void renderer_gl_batch_free(renderer_gl_batch batch) {
-  if (batch.vertices) {
-    sc_list_renderer_gl_vertex_free(batch.vertices);
+  if (batch.mesh) {
+    renderer_gl__mesh_release(batch.mesh);
+  } else {
+    if (batch.vertices) {
+      sc_list_renderer_gl_vertex_free(batch.vertices);
+    }
+
+    if (batch.indices) {
+      sc_list_GLuint_free(batch.indices);
+    }
+
+    renderer_gl__delete_buffer(&batch.VBO);
+    renderer_gl__delete_buffer(&batch.EBO);
+
+    if (batch.pooled) {
+      renderer_gl__range_free(&renderer_gl__pool.vertices,
+                              batch.pool_base_vertex, batch.pool_vertex_count);
+      renderer_gl__range_free(&renderer_gl__pool.indices,
+                              batch.pool_first_index, batch.pool_index_count);
+    }
   }
 
-  if (batch.indices) {
-    sc_list_GLuint_free(batch.indices);
+  for (unsigned int i = 0; i < batch.lods_count; i++) {
+    renderer_gl_batch_free(batch.lods[i]);
   }
+  free(batch.lods);
+  free(batch.lod_levels);
 
   free(batch.matrices);
-  free(batch.transform);
-  glDeleteBuffers(1, &batch.model_matrix_buffer);
-  glDeleteBuffers(1, &batch.VBO);
-  glDeleteBuffers(1, &batch.EBO);
-  glDeleteVertexArrays(1, &batch.VAO);
+  renderer_gl_transforms_free(batch.transforms);
+  free(batch.dirty);
+  sc_list_GLuint_free(batch.dirty_indices);
+  renderer_gl__instance_stream_free(batch.instance_stream);
+  if (batch.gpu_culling) {
+    renderer_gl__delete_buffer(&batch.gpu_culling->transform_buffer);
+    renderer_gl__delete_buffer(&batch.gpu_culling->matrix_buffer);
+    renderer_gl__delete_buffer(&batch.gpu_culling->command_buffer);
+    free(batch.gpu_culling);
+  }
+  renderer_gl__delete_buffer(&batch.model_matrix_buffer);
+  renderer_gl__delete_vertex_array(&batch.VAO);
 }
 
 renderer_gl_framebuffer
@@ -992,7 +3814,7 @@ renderer_gl_framebuffer_alloc(GLuint shader, GLuint samples,
     glGenTextures(num_color_attachments, frame.color_buffers);
 
     for (unsigned int i = 0; i < num_color_attachments; i++) {
-      glBindTexture(GL_TEXTURE_2D, frame.color_buffers[i]);
+      renderer_gl__bind_texture(0, frame.color_buffers[i]);
 
       glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_FLOAT,
                    NULL);
@@ -1043,9 +3865,11 @@ renderer_gl_framebuffer_alloc(GLuint shader, GLuint samples,
 
 void renderer_gl_framebuffer_free(renderer_gl_framebuffer frame) {
   renderer_gl_batch_free(frame.quad);
-  free(frame.color_buffers);
   glDeleteFramebuffers(1, &frame.FBO);
-  glDeleteTextures(frame.color_buffers_count, frame.color_buffers);
+  for (unsigned int i = 0; i < frame.color_buffers_count; i++) {
+    renderer_gl__delete_texture(&frame.color_buffers[i]);
+  }
+  free(frame.color_buffers);
   glDeleteRenderbuffers(1, &frame.RBO);
 }
 
@@ -1107,6 +3931,10 @@ renderer_gl_context *renderer_gl_start(const int width, const int height) {
   renderer_gl__active_context->time_last = 0;
   renderer_gl__active_context->time_FPS = 0;
   renderer_gl__active_context->draw_calls = 0;
+  renderer_gl__active_context->state_changes = 0;
+  renderer_gl__active_context->state_changes_skipped = 0;
+  renderer_gl__active_context->instances_tested = 0;
+  renderer_gl__active_context->instances_visible = 0;
 
   if (!glfwInit()) {
     debug_error("Failed to initialize GLFW!");
@@ -1164,6 +3992,10 @@ renderer_gl_context *renderer_gl_start(const int width, const int height) {
   glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
   glStencilFunc(GL_ALWAYS, 1, 0xFF);
 
+  renderer_gl_state_invalidate();
+
+  jobs_start(0);
+
   debug_log("Startup completed successfuly");
   debug_log("Success!");
 
@@ -1175,13 +4007,19 @@ void renderer_gl_update_window_title(void) {
   timer += renderer_gl__active_context->time_delta;
   if (timer > 1) { // window titlebar
     timer = 0;
-    char window_title[64] = {0};
+    char window_title[128] = {0};
 
     snprintf(window_title, sizeof(window_title),
-             "Lite-Engine Demo. | %.0lf FPS | %.4f DT | BATCHES %d",
+             "Lite-Engine Demo. | %.0lf FPS | %.4f DT | BATCHES %d | "
+             "STATE %u/%u | CULL %u/%u",
              renderer_gl__active_context->time_FPS,
              renderer_gl__active_context->time_delta,
-             renderer_gl__active_context->draw_calls);
+             renderer_gl__active_context->draw_calls,
+             renderer_gl__active_context->state_changes,
+             renderer_gl__active_context->state_changes +
+                 renderer_gl__active_context->state_changes_skipped,
+             renderer_gl__active_context->instances_visible,
+             renderer_gl__active_context->instances_tested);
 
     glfwSetWindowTitle(renderer_gl__active_context->GLFWwindow, window_title);
   }
@@ -1219,14 +4057,79 @@ void renderer_gl_free(renderer_gl_context *context) {
   context->is_running = 0;
   free(context);
 
+  if (renderer_gl__uniforms_cache) {
+    sc_foreach(i, sc_list_renderer_gl__uniforms_count(
+                      renderer_gl__uniforms_cache)) {
+      free(renderer_gl__uniforms_cache[i].lights);
+    }
+    sc_list_renderer_gl__uniforms_free(renderer_gl__uniforms_cache);
+    renderer_gl__uniforms_cache = NULL;
+  }
+
+  free(renderer_gl__queue.entries);
+  free(renderer_gl__queue.scratch);
+  renderer_gl__queue.entries = NULL;
+  renderer_gl__queue.scratch = NULL;
+  renderer_gl__queue.count = 0;
+  renderer_gl__queue.capacity = 0;
+
+  if (renderer_gl__gpu_cull.program) {
+    renderer_gl_shader_free(renderer_gl__gpu_cull.program);
+  }
+  memset(&renderer_gl__gpu_cull, 0, sizeof(renderer_gl__gpu_cull));
+
+  free(renderer_gl__cull.visible);
+  renderer_gl__cull.visible = NULL;
+  renderer_gl__cull.capacity = 0;
+
+  renderer_gl__delete_vertex_array(&renderer_gl__pool.VAO);
+  renderer_gl__delete_buffer(&renderer_gl__pool.VBO);
+  renderer_gl__delete_buffer(&renderer_gl__pool.EBO);
+  renderer_gl__delete_buffer(&renderer_gl__pool.command_buffer);
+  renderer_gl__delete_buffer(&renderer_gl__pool.draw_buffer);
+  if (renderer_gl__pool.vertices.free_ranges) {
+    sc_list_renderer_gl__range_free(renderer_gl__pool.vertices.free_ranges);
+  }
+  if (renderer_gl__pool.indices.free_ranges) {
+    sc_list_renderer_gl__range_free(renderer_gl__pool.indices.free_ranges);
+  }
+  free(renderer_gl__pool.commands);
+  free(renderer_gl__pool.draws);
+  memset(&renderer_gl__pool, 0, sizeof(renderer_gl__pool));
+  renderer_gl_state_invalidate();
+
+  renderer_gl__delete_buffer(&renderer_gl__lights.buffer);
+  free(renderer_gl__lights.lights);
+  renderer_gl__lights.buffer = 0;
+  renderer_gl__lights.capacity = 0;
+  renderer_gl__lights.lights = NULL;
+  renderer_gl__lights.lights_count = 0;
+
+  // drops the decodes still queued and waits for the running ones, so no
+  // worker touches the loads below anymore
+  jobs_free();
+
+  for (size_t i = 0; i < renderer_gl__texture_loads.count; i++) {
+    renderer_gl__texture_load_free(renderer_gl__texture_loads.loads[i]);
+  }
+  free(renderer_gl__texture_loads.loads);
+  renderer_gl__delete_buffer(&renderer_gl__texture_loads.pixel_buffer);
+  memset(&renderer_gl__texture_loads, 0, sizeof(renderer_gl__texture_loads));
+
   debug_log("Shutdown complete");
 }
 
 void renderer_gl_end_frame(void) {
+  renderer_gl__textures_update();
+  renderer_gl_flush();
   renderer_gl__time_update();
   glfwPollEvents();
   glfwSwapBuffers(renderer_gl__active_context->GLFWwindow);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
   renderer_gl_update_window_title();
   renderer_gl__active_context->draw_calls = 0;
+  renderer_gl__active_context->state_changes = 0;
+  renderer_gl__active_context->state_changes_skipped = 0;
+  renderer_gl__active_context->instances_tested = 0;
+  renderer_gl__active_context->instances_visible = 0;
 }
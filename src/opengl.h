@@ -12,11 +12,10 @@
 extern "C" {
 #endif // ifdef __cplusplus
 
+#include "bvh.h"
 #include "collections.h"
 #include "math3d.h"
-
-SC_LIST(vector3)
-SC_LIST(vector2)
+#include "obj.h"
 
 #include "glad/gl.h"
 #include <GLFW/glfw3.h>
@@ -27,6 +26,7 @@ SC_LIST(vector2)
 #include "collections.h"
 
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 
 SC_LIST(GLuint)
@@ -38,6 +38,34 @@ typedef struct {
 } renderer_gl_vertex;
 SC_LIST(renderer_gl_vertex)
 
+// The 16 byte vertex of batches packed by renderer_gl_batch_pack_vertices.
+// Attributes 0-2 read it as normalized shorts, so shaders that draw packed
+// batches decode the position and normal themselves:
+//
+//   uniform bool u_packed_vertices;
+//   uniform vec3 u_position_offset;
+//   uniform vec3 u_position_scale;
+//
+//   vec3 position = u_position_offset + a_position * u_position_scale;
+//   vec3 normal = a_normal;
+//   if (u_packed_vertices) {
+//     normal = vec3(a_normal.xy, 1.0 - abs(a_normal.x) - abs(a_normal.y));
+//     float t = max(-normal.z, 0.0);
+//     normal.xy += vec2(normal.x >= 0.0 ? -t : t, normal.y >= 0.0 ? -t : t);
+//     normal = normalize(normal);
+//   }
+//
+// Full float batches get an offset of 0 and a scale of 1, so the same shader
+// draws both.
+typedef struct {
+  // snorm16 of the position relative to the bounding box of the mesh, w unused
+  GLshort position[4];
+  // snorm16 octahedral encoding of the normal
+  GLshort normal[2];
+  // unorm16, texture coordinates outside [0, 1] are clamped
+  GLushort texture_coordinates[2];
+} renderer_gl_packed_vertex;
+
 typedef struct {
   int type;
   vector3 position;
@@ -51,12 +79,106 @@ typedef struct {
   vector3 specular;
 } renderer_gl_light;
 
+// Shader storage binding used for lights. Shaders that declare the block below
+// receive every light through one buffer shared by all batches. The buffer is
+// only uploaded when a batch brings lights that differ from the ones it holds,
+// so batches sharing one light array upload at most once per frame, while
+// batches alternating between arrays upload on every switch. Shaders without
+// it fall back to the u_lights[] uniform array.
+//
+//   struct light_std430 {
+//     vec4 position;  // xyz
+//     vec4 direction; // xyz
+//     vec4 diffuse;   // xyz
+//     vec4 specular;  // xyz
+//     int type;
+//     float cut_off;
+//     float outer_cut_off;
+//     float constant;
+//     float linear;
+//     float quadratic;
+//   };
+//
+//   layout(std430) readonly buffer renderer_gl_lights_block {
+//     uint u_lights_count;
+//     light_std430 u_lights[];
+//   };
+#define RENDERER_GL_LIGHTS_BINDING (0)
+
+// Shader storage binding of the per draw data of merged draws. Pooled batches
+// (see renderer_gl_batch_pool) drawn through the draw queue are merged into one
+// glMultiDrawElementsIndirect when they share shader, textures, flags and
+// lights, and their shader declares the block below. While u_use_multi_draw
+// is set, the shader reads its model matrix and color from u_draws[gl_DrawID]
+// instead of u_model_matrix and u_color.
+//
+//   struct draw_std430 {
+//     mat4 model_matrix;
+//     vec4 color;
+//   };
+//
+//   layout(std430) readonly buffer renderer_gl_draws_block {
+//     draw_std430 u_draws[];
+//   };
+#define RENDERER_GL_DRAWS_BINDING (1)
+
+// Instanced batches with RENDERER_GL_FLAG_USE_INSTANCE_TRANSFORMS upload these
+// 40 bytes per instance instead of a 64 byte model matrix, and the vertex
+// shader builds the matrix while u_use_instance_transforms is set. Attributes
+// 3, 4 and 5 then hold position, scale and rotation, so the columns of the
+// instance matrix attribute carry them instead:
+//
+//   layout(location = 3) in mat4 a_model_matrix;
+//   uniform bool u_use_instance_transforms;
+//
+//   mat4 model = a_model_matrix;
+//   if (u_use_instance_transforms) {
+//     vec3 p = a_model_matrix[0].xyz;
+//     vec3 s = a_model_matrix[1].xyz;
+//     vec4 q = a_model_matrix[2];
+//     vec3 q2 = q.xyz * 2.0;
+//     float xx = q.x * q2.x, xy = q.x * q2.y, xz = q.x * q2.z;
+//     float yy = q.y * q2.y, yz = q.y * q2.z, zz = q.z * q2.z;
+//     float xw = q.w * q2.x, yw = q.w * q2.y, zw = q.w * q2.z;
+//     model = mat4(vec4(vec3(1.0 - (yy + zz), xy + zw, xz - yw) * s.x, 0.0),
+//                  vec4(vec3(xy - zw, 1.0 - (xx + zz), yz + xw) * s.y, 0.0),
+//                  vec4(vec3(xz + yw, yz - xw, 1.0 - (xx + yy)) * s.z, 0.0),
+//                  vec4(p, 1.0));
+//   }
 typedef struct {
   vector3 position;
   vector3 scale;
   vector4 rotation;
 } renderer_gl_transform;
 
+// alignment in bytes of every stream of renderer_gl_transforms, a cache line
+#define RENDERER_GL_TRANSFORMS_ALIGNMENT (64)
+
+// The instance transforms of a batch as a structure of arrays, one float per
+// instance in each component stream. Code that only moves instances only
+// touches the position streams, and the matrix build and culling load whole
+// SIMD registers of instances at once. Every stream starts on a
+// RENDERER_GL_TRANSFORMS_ALIGNMENT boundary. block is the single allocation
+// behind all of them.
+typedef struct {
+  GLfloat *position[3];
+  GLfloat *rotation[4];
+  GLfloat *scale[3];
+  void *block;
+} renderer_gl_transforms;
+
+// Allocates count identity transforms.
+renderer_gl_transforms renderer_gl_transforms_alloc(const unsigned int count);
+void renderer_gl_transforms_free(renderer_gl_transforms transforms);
+
+// Gathers and scatters the transform of one instance.
+renderer_gl_transform
+renderer_gl_transforms_get(const renderer_gl_transforms *transforms,
+                           const unsigned int index);
+void renderer_gl_transforms_set(renderer_gl_transforms *transforms,
+                                const unsigned int index,
+                                const renderer_gl_transform transform);
+
 void renderer_gl_camera_update(GLfloat *matrix,
                                renderer_gl_transform transform);
 
@@ -70,15 +192,82 @@ typedef struct {
   double time_last;
   double time_FPS;
   unsigned int draw_calls;
+  // GL state calls issued and skipped by the state cache this frame
+  unsigned int state_changes;
+  unsigned int state_changes_skipped;
+  // instances tested against the view frustum and found visible this frame
+  unsigned int instances_tested;
+  unsigned int instances_visible;
 } renderer_gl_context;
 
+// Instanced batches stream their model matrices through a persistently mapped
+// buffer split into this many regions. The CPU writes one region while the GPU
+// may still be reading the others.
+#define RENDERER_GL_INSTANCE_STREAM_REGIONS (3)
+
+typedef struct {
+  GLfloat *mapped;
+  GLsync fences[RENDERER_GL_INSTANCE_STREAM_REGIONS];
+  GLuint region;
+  GLsizeiptr region_size;
+} renderer_gl_instance_stream;
+
+// Buffers of RENDERER_GL_FLAG_USE_GPU_CULLING. Batches leave it NULL until
+// their first culling dispatch creates it.
 typedef struct {
-  renderer_gl_transform *transform;
+  GLuint transform_buffer;
+  GLuint matrix_buffer;
+  GLuint command_buffer;
+} renderer_gl_gpu_culling;
+
+// Geometry shared between batches by the mesh cache, see
+// renderer_gl_batch_alloc.
+typedef struct renderer_gl_mesh renderer_gl_mesh;
+
+// coarser meshes a batch can switch to, see renderer_gl_batch_lod_add
+#define RENDERER_GL_LODS_MAX (8)
+
+typedef struct renderer_gl_batch {
+  renderer_gl_transforms transforms;
   GLfloat *matrices;
+  renderer_gl_instance_stream *instance_stream;
+  renderer_gl_gpu_culling *gpu_culling;
+  // the cached geometry behind VBO, EBO, vertices and indices, or NULL when
+  // the batch owns them
+  renderer_gl_mesh *mesh;
+
+  unsigned char *dirty;
+  sc_list_GLuint dirty_indices;
+
+  // location of the mesh in the shared mesh pool, see renderer_gl_batch_pool
+  int pooled;
+  GLint pool_base_vertex;
+  GLuint pool_vertex_count;
+  GLuint pool_first_index;
+  GLuint pool_index_count;
+
+  // bounding sphere of the mesh in model space
+  vector3 bounds_center;
+  GLfloat bounds_radius;
+
+  // level k > 0 draws lods[k - 1]. instances use level k while their screen
+  // size is below lod_screen_sizes[k - 1], and remember it in lod_levels.
+  struct renderer_gl_batch *lods;
+  unsigned int lods_count;
+  GLfloat lod_screen_sizes[RENDERER_GL_LODS_MAX];
+  unsigned char *lod_levels;
 
   GLuint VAO;
   GLuint VBO;
   GLuint EBO;
+  // GL_UNSIGNED_SHORT when EBO holds 16 bit indices, which meshes of at most
+  // 65536 vertices get. indices always holds them as GLuint.
+  GLenum index_type;
+  // set when VBO holds renderer_gl_packed_vertex, whose positions decode to
+  // position_offset + position * position_scale. vertices keeps full floats.
+  int packed;
+  vector3 position_offset;
+  vector3 position_scale;
   GLuint model_matrix_buffer;
 
   sc_list_renderer_gl_vertex vertices;
@@ -119,6 +308,31 @@ void renderer_gl_active_framebuffer_set_MSAA(renderer_gl_framebuffer *frame);
 
 void renderer_gl_draw(const renderer_gl_batch *batch);
 
+// The renderer skips GL calls that would set state it already set, and leaves
+// the last program, textures and vertex array bound after renderer_gl_draw.
+// Call this after changing that state outside the renderer.
+void renderer_gl_state_invalidate(void);
+
+// Queues batch to be drawn by the next renderer_gl_flush, which
+// renderer_gl_end_frame calls before swapping buffers. Queued batches are
+// sorted to minimize state changes: opaque batches by shader, textures and
+// flags then front to back, followed by RENDERER_GL_FLAG_USE_TRANSPARENCY
+// batches back to front. batch must stay valid until the flush.
+void renderer_gl_submit(const renderer_gl_batch *batch);
+void renderer_gl_flush(void);
+
+// Copies the triangles of batch into the mesh pool shared by all batches, so
+// renderer_gl_flush can merge it with other batches into one multi draw call.
+// Call after the mesh is allocated. The batch keeps its own buffers for draws
+// that cannot be merged. Batches sharing a cached mesh share one copy.
+void renderer_gl_batch_pool(renderer_gl_batch *batch);
+
+// Re-uploads the vertices of batch and its levels of detail as
+// renderer_gl_packed_vertex, half the size of renderer_gl_vertex, and logs the
+// largest quantization errors. Batches sharing a cached mesh share its packed
+// copy. Call before renderer_gl_batch_pool, the pool keeps full floats.
+void renderer_gl_batch_pack_vertices(renderer_gl_batch *batch);
+
 enum {
   RENDERER_GL__FLAGS_BEGIN = 1,
   RENDERER_GL_FLAG_ENABLED = 1 << 1,
@@ -126,6 +340,11 @@ enum {
   RENDERER_GL_FLAG_DRAW_POINTS = 1 << 3,
   RENDERER_GL_FLAG_USE_WIREFRAME = 1 << 4,
   RENDERER_GL_FLAG_USE_INSTANCING = 1 << 5,
+  RENDERER_GL_FLAG_USE_DIRTY_TRACKING = 1 << 6,
+  RENDERER_GL_FLAG_USE_TRANSPARENCY = 1 << 7,
+  RENDERER_GL_FLAG_USE_CULLING = 1 << 8,
+  RENDERER_GL_FLAG_USE_GPU_CULLING = 1 << 9,
+  RENDERER_GL_FLAG_USE_INSTANCE_TRANSFORMS = 1 << 10,
   RENDERER_GL__FLAGS_END,
 
   RENDERER_GL__PRIMITIVES_BEGIN,
@@ -151,23 +370,141 @@ void renderer_gl_viewport_set(const GLfloat width, const GLfloat height);
 
 GLuint renderer_gl_shader_compile(const char *file_path, GLenum type);
 GLuint renderer_gl_shader_link(GLuint vertex_shader, GLuint fragment_shader);
-
+// Deletes a program and forgets the uniform locations cached for it.
+void renderer_gl_shader_free(GLuint shader);
+
+// Allocates count instances of a batch. The archetype meshes,
+// renderer_gl_icosphere_mesh_alloc and renderer_gl_mesh_obj_alloc share their
+// vertex and index buffers through a reference counted cache keyed by
+// archetype, subdivisions and file path, so batches of the same mesh only
+// allocate their own vertex array and instance data. Treat the vertices and
+// indices of such batches as read only.
 renderer_gl_batch renderer_gl_batch_alloc(const unsigned int count,
                                           const unsigned int archetype);
 
 void renderer_gl_batch_free(renderer_gl_batch batch);
+
+// With RENDERER_GL_FLAG_USE_DIRTY_TRACKING set, instanced batches only rebuild
+// and upload the matrices of instances marked here. Either write the transform
+// through renderer_gl_batch_transform_set or modify the streams of
+// batch->transforms at index directly and call
+// renderer_gl_batch_transform_dirty afterwards.
+void renderer_gl_batch_transform_dirty(renderer_gl_batch *batch,
+                                       const unsigned int index);
+void renderer_gl_batch_transform_set(renderer_gl_batch *batch,
+                                     const unsigned int index,
+                                     const renderer_gl_transform transform);
+// With RENDERER_GL_FLAG_USE_CULLING set, batches whose bounding sphere is
+// outside the view frustum of the last renderer_gl_camera_update are skipped,
+// and instanced batches only upload and draw their visible instances. Culled
+// instance buffers are packed, so mark every instance dirty when clearing the
+// flag on a batch that also uses dirty tracking.
+//
+// RENDERER_GL_FLAG_USE_GPU_CULLING culls the instances of instanced batches in
+// a compute shader instead: the raw transforms are uploaded, and the visible
+// matrices and their count are written on the GPU for one indirect draw. Needs
+// OpenGL 4.3, batches fall back to the CPU path otherwise. Nothing is read
+// back, so these instances are not part of the culling counters.
+//
+// RENDERER_GL_FLAG_USE_INSTANCE_TRANSFORMS uploads the raw transforms of
+// instanced batches instead of matrices, see renderer_gl_transform. Batches
+// with levels of detail or on the GPU culling path keep uploading matrices.
+// The cached matrices are not kept up to date, so mark every instance dirty
+// when clearing the flag on a batch that uses dirty tracking.
+//
+// Recomputes the bounding sphere used by RENDERER_GL_FLAG_USE_CULLING from
+// batch->vertices. The mesh allocators call this, call it again after
+// modifying the vertices by hand.
+void renderer_gl_batch_bounds_update(renderer_gl_batch *batch);
+
+// One instance of a batch indexed by a renderer_gl_scene.
+typedef struct {
+  renderer_gl_batch *batch;
+  unsigned int instance;
+} renderer_gl_scene_item;
+
+// A bounding volume hierarchy over every instance of a set of batches. Each
+// instance is bounded by the batch bounding sphere moved by its transform.
+typedef struct {
+  bvh tree;
+  renderer_gl_scene_item *items;
+  vector4 *spheres;
+  bvh_aabb *bounds;
+  unsigned int count;
+  float built_cost;
+} renderer_gl_scene;
+
+void renderer_gl_scene_build(renderer_gl_scene *scene,
+                             renderer_gl_batch **batches,
+                             const unsigned int batch_count);
+void renderer_gl_scene_free(renderer_gl_scene *scene);
+
+// Call after transforms of the indexed instances changed. Refits the tree, and
+// rebuilds it once refitting made it twice as costly to traverse as the
+// build.
+void renderer_gl_scene_refit(renderer_gl_scene *scene);
+
+// Visits the index in scene->items of every instance inside the view frustum
+// of the last renderer_gl_camera_update.
+void renderer_gl_scene_cull(const renderer_gl_scene *scene,
+                            bvh_visit_function visit, void *user);
+
+// Finds the instance hit first by the ray, or the instance nearest to point.
+// Return 0 when the scene is empty or nothing is hit.
+int renderer_gl_scene_pick(const renderer_gl_scene *scene, vector3 origin,
+                           vector3 direction, renderer_gl_scene_item *hit);
+int renderer_gl_scene_nearest(const renderer_gl_scene *scene, vector3 point,
+                              renderer_gl_scene_item *nearest);
+
 void renderer_gl_lines_alloc(renderer_gl_batch *batch, sc_list_vector3 points);
 void renderer_gl_mesh_obj_alloc(renderer_gl_batch *batch, const char *filepath);
 
 void renderer_gl_icosphere_mesh_alloc(renderer_gl_batch *batch,
                                       const unsigned int subdivisions);
 
+// Adds mesh as the next coarser level of detail of batch, drawn for instances
+// whose bounding sphere covers less than screen_size of the screen height.
+// Add levels finest first with decreasing sizes. The batch takes ownership of
+// mesh and frees it with itself. Instances switch levels with some hysteresis
+// so they do not pop back and forth at the thresholds, and instanced batches
+// draw each level with its own instanced draw. Batches with levels are never
+// merged into multi draws, and RENDERER_GL_FLAG_USE_GPU_CULLING falls back to
+// RENDERER_GL_FLAG_USE_CULLING for them.
+void renderer_gl_batch_lod_add(renderer_gl_batch *batch,
+                               renderer_gl_batch mesh,
+                               const GLfloat screen_size);
+
+// Allocates an icosphere of subdivisions into batch with every coarser
+// subdivision as its levels of detail.
+void renderer_gl_icosphere_lods_alloc(renderer_gl_batch *batch,
+                                      const unsigned int subdivisions);
+
 void renderer_gl_perspective(GLfloat *mat, const GLfloat fov,
                              const GLfloat aspect, const GLfloat near,
                              const GLfloat far);
 
 GLuint renderer_gl_texture_alloc(const char *imageFile);
 
+// Bytes renderer_gl_end_frame uploads at most per frame for
+// renderer_gl_texture_alloc_async, beyond the first texture of the frame.
+#define RENDERER_GL_TEXTURE_UPLOAD_BUDGET (8 << 20)
+
+// Returns a texture at once and decodes imageFile on a job worker meanwhile.
+// The texture holds a grey 1x1 placeholder until renderer_gl_end_frame
+// uploads the image through a pixel buffer, within
+// RENDERER_GL_TEXTURE_UPLOAD_BUDGET. The texture name stays the same, so
+// batches can use it right away. A failed load logs an error and keeps the
+// placeholder.
+GLuint renderer_gl_texture_alloc_async(const char *imageFile);
+
+// Textures of renderer_gl_texture_alloc_async not uploaded yet.
+unsigned int renderer_gl_textures_loading(void);
+
+// Deletes a texture of renderer_gl_texture_alloc or
+// renderer_gl_texture_alloc_async. A load still pending for it is cancelled,
+// so it never uploads into a texture that reuses the name.
+void renderer_gl_texture_free(GLuint texture);
+
 #ifdef __cplusplus
 }
 #endif // ifdef __cplusplus